@@ -98,6 +98,29 @@ def microseconds(v: str) -> int:
         raise ValueError("Invalid interval: %s" % v) from e
 
 
+def seconds(v: str) -> int:
+    try:
+        if v.endswith("h"):
+            return int(v[:-1]) * 3600
+        if v.endswith("m"):
+            return int(v[:-1]) * 60
+        if v.endswith("s"):
+            return int(v[:-1])
+        return int(v)
+    except Exception as e:
+        raise ValueError("Invalid interval: %s" % v) from e
+
+
+def size(v: str) -> int:
+    try:
+        for i, unit in enumerate("KMG", 1):
+            if v.upper().endswith(unit):
+                return int(v[:-1]) * 1024**i
+        return int(v)
+    except Exception as e:
+        raise ValueError("Invalid size: %s" % v) from e
+
+
 def main() -> None:
     parser = argparse.ArgumentParser(
         description="In-process CPython frame stack sampler",
@@ -131,6 +154,27 @@ def main() -> None:
         help="Collect memory allocation events",
         action="store_true",
     )
+    parser.add_argument(
+        "--memory-sample-rate",
+        help="in memory mode, sample allocations once every given number of "
+        "bytes on average (e.g. 512K), rather than tracking each of them",
+        metavar="SIZE",
+        type=size,
+        default=0,
+    )
+    parser.add_argument(
+        "--leak-epochs",
+        help="in memory mode, report the stacks whose live memory keeps growing "
+        "over the given number of flushes as leak suspects (implies --stack-refs)",
+        metavar="K",
+        type=int,
+        default=0,
+    )
+    parser.add_argument(
+        "--heap-snapshot-signal",
+        help="in memory mode, take a heap snapshot when the process receives SIGUSR1",
+        action="store_true",
+    )
     parser.add_argument(
         "-n",
         "--native",
@@ -144,18 +188,120 @@ def main() -> None:
         type=str,
         default="%%(pid).echion",
     )
+    parser.add_argument(
+        "--format",
+        help="output format: MOJO samples (mojo), a pprof profile written on "
+        "exit (pprof), gzipped if the output name ends with .gz, folded "
+        "stacks for flame graphs (collapsed), or a Trace Event timeline (trace)",
+        choices=["mojo", "pprof", "collapsed", "trace"],
+        default="mojo",
+    )
+    parser.add_argument(
+        "-z",
+        "--compress",
+        help="compress the output with xz at the given preset (0-9)",
+        metavar="PRESET",
+        type=int,
+        choices=range(10),
+        default=-1,
+    )
+    parser.add_argument(
+        "--compress-flush",
+        help="interval between flushes of the compressed output, in milliseconds",
+        metavar="MS",
+        type=int,
+        default=1000,
+    )
+    parser.add_argument(
+        "--rotate-size",
+        help="start a new output segment when the current one reaches the given "
+        "uncompressed size (e.g. 64M)",
+        metavar="SIZE",
+        type=size,
+        default=0,
+    )
+    parser.add_argument(
+        "--rotate-interval",
+        help="start a new output segment at the given interval (e.g. 10m)",
+        metavar="INTERVAL",
+        type=seconds,
+        default=0,
+    )
+    parser.add_argument(
+        "--shm-size",
+        help="size of the shared memory ring used with a shm:NAME output "
+        "(e.g. 16M)",
+        metavar="SIZE",
+        type=size,
+        default=16 << 20,
+    )
+    parser.add_argument(
+        "--socket-queue",
+        help="disconnect subscribers of a unix:PATH output when more than the "
+        "given amount of data is waiting to be sent to them (e.g. 4M)",
+        metavar="SIZE",
+        type=size,
+        default=4 << 20,
+    )
+    parser.add_argument(
+        "-a",
+        "--aggregate",
+        help="aggregate identical samples in-process and write them out at the "
+        "given interval (e.g. 30s)",
+        metavar="INTERVAL",
+        type=seconds,
+        default=0,
+    )
+    parser.add_argument(
+        "--fold",
+        help="fold consecutive identical samples of each thread into a single "
+        "one, for at most the given interval (e.g. 5s)",
+        metavar="INTERVAL",
+        type=seconds,
+        default=0,
+    )
+    parser.add_argument(
+        "--flight-recorder",
+        help="keep the samples of the given interval (e.g. 60s) in memory, "
+        "and write them out only on demand, with SIGUSR2, echion.core.dump, or "
+        "on an unhandled exception",
+        metavar="INTERVAL",
+        type=seconds,
+        default=0,
+    )
+    parser.add_argument(
+        "--flight-recorder-size",
+        help="memory budget of the flight recorder (e.g. 64M)",
+        metavar="SIZE",
+        type=size,
+        default=64 << 20,
+    )
     parser.add_argument(
         "-p",
         "--pid",
         help="Attach to the process with the given PID",
         type=int,
     )
+    parser.add_argument(
+        "--stack-refs",
+        help="write each unique stack once and refer to it from samples "
+        "(MOJO version 4)",
+        action="store_true",
+    )
     parser.add_argument(
         "-s",
         "--stealth",
         help="stealth mode (sampler thread is not accounted for)",
         action="store_true",
     )
+    parser.add_argument(
+        "-t",
+        "--task-names",
+        help="asyncio task names: as is (raw), with numeric suffixes stripped "
+        "(fold), or the coroutine name (coro)",
+        choices=["raw", "fold", "coro"],
+        default="raw",
+    )
     parser.add_argument(
         "-w",
         "--where",
@@ -190,14 +336,46 @@ def main() -> None:
 
     # TODO: Validate arguments
 
+    if args.output == parser.get_default("output"):
+        if args.format == "pprof":
+            args.output = "%%(pid).pb.gz"
+        elif args.format == "collapsed":
+            args.output = "%%(pid).folded"
+        elif args.format == "trace":
+            args.output = "%%(pid).trace.json"
+
+    if (
+        args.compress >= 0
+        and not args.output.endswith(".xz")
+        and not args.output.startswith(("shm:", "unix:", "mmap:"))
+        and not args.flight_recorder
+    ):
+        args.output += ".xz"
+
     env = os.environ.copy()
 
+    env["ECHION_AGGREGATE"] = str(args.aggregate)
+    env["ECHION_FLIGHT_RECORDER"] = str(args.flight_recorder)
+    env["ECHION_FLIGHT_RECORDER_SIZE"] = str(args.flight_recorder_size)
+    env["ECHION_FOLD"] = str(args.fold)
+    env["ECHION_FORMAT"] = args.format
     env["ECHION_INTERVAL"] = str(args.interval)
+    env["ECHION_COMPRESSION"] = str(args.compress)
+    env["ECHION_COMPRESSION_FLUSH"] = str(args.compress_flush)
     env["ECHION_CPU"] = str(int(bool(args.cpu)))
     env["ECHION_MEMORY"] = str(int(bool(args.memory)))
+    env["ECHION_MEMORY_SAMPLE_RATE"] = str(args.memory_sample_rate)
+    env["ECHION_LEAK_EPOCHS"] = str(args.leak_epochs)
+    env["ECHION_HEAP_SNAPSHOT_SIGNAL"] = str(int(bool(args.heap_snapshot_signal)))
     env["ECHION_NATIVE"] = str(int(bool(args.native)))
     env["ECHION_OUTPUT"] = args.output.replace("%%(pid)", str(os.getpid()))
+    env["ECHION_ROTATE_INTERVAL"] = str(args.rotate_interval)
+    env["ECHION_ROTATE_SIZE"] = str(args.rotate_size)
+    env["ECHION_SHM_SIZE"] = str(args.shm_size)
+    env["ECHION_SOCKET_QUEUE"] = str(args.socket_queue)
+    env["ECHION_STACK_REFS"] = str(int(bool(args.stack_refs)))
     env["ECHION_STEALTH"] = str(int(bool(args.stealth)))
+    env["ECHION_TASK_NAMES"] = args.task_names
     env["ECHION_WHERE"] = str(args.where or "")
 
     if args.pid or args.where:
@@ -0,0 +1,82 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// ----------------------------------------------------------------------------
+// Folds samples with the same thread and stack together, summing their
+// metrics. Memory metrics are deltas, which are negative for frees, so the
+// totals are signed. Samples are identified by an opaque key, e.g. their encoded MOJO
+// bytes, that is the stack event (PID, interpreter ID and thread name)
+// followed by the frame or stack references, so the same key works whether
+// stacks are interned or not.
+class SampleAggregator
+{
+public:
+    struct Aggregate
+    {
+        int64_t metric = 0;
+    };
+
+    // ------------------------------------------------------------------------
+    void add(const char* sample, size_t size, int64_t metric)
+    {
+        // Reuse the key storage across calls to avoid an allocation for every
+        // sample; a copy is only made when the stack is new.
+        static thread_local std::string key;
+        key.assign(sample, size);
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        auto& aggregate = table[key];
+        aggregate.metric += metric;
+    }
+
+    // ------------------------------------------------------------------------
+    // Whether the aggregated samples are older than the given interval.
+    bool due(unsigned int interval)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        return !table.empty() && std::chrono::steady_clock::now() - last_flush >=
+                                     std::chrono::seconds(interval);
+    }
+
+    // ------------------------------------------------------------------------
+    // Pass every aggregated sample to the given function and start afresh.
+    template <typename F>
+    void flush(F emit)
+    {
+        std::unordered_map<std::string, Aggregate> samples;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            samples.swap(table);
+            last_flush = std::chrono::steady_clock::now();
+        }
+
+        for (auto& [sample, aggregate] : samples)
+            emit(sample, aggregate);
+    }
+
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        table.clear();
+        last_flush = std::chrono::steady_clock::now();
+    }
+
+private:
+    std::unordered_map<std::string, Aggregate> table;
+    std::chrono::steady_clock::time_point last_flush = std::chrono::steady_clock::now();
+    std::mutex lock;
+};
@@ -25,6 +25,30 @@ def restart_on_fork():
     start()
 
 
+def dump_on_exception(hook):
+    def _(*args):
+        try:
+            print(f"echion: flight recorder dumped to {ec.dump()}", file=sys.stderr)
+        except RuntimeError as e:
+            print(f"echion: {e}", file=sys.stderr)
+
+        return hook(*args)
+
+    _.__echion_hook__ = hook
+
+    return _
+
+
+def install_excepthooks():
+    import threading
+
+    # Wrap the hooks only once, e.g. across forks.
+    if not hasattr(sys.excepthook, "__echion_hook__"):
+        sys.excepthook = dump_on_exception(sys.excepthook)
+    if not hasattr(threading.excepthook, "__echion_hook__"):
+        threading.excepthook = dump_on_exception(threading.excepthook)
+
+
 def start():
     global do_on_fork
 
@@ -32,8 +56,34 @@ def start():
     ec.set_interval(int(os.getenv("ECHION_INTERVAL", 1000)))
     ec.set_cpu(bool(int(os.getenv("ECHION_CPU", 0))))
     ec.set_memory(bool(int(os.getenv("ECHION_MEMORY", 0))))
+    ec.set_memory_sample_rate(int(os.getenv("ECHION_MEMORY_SAMPLE_RATE", 0)))
+    ec.set_leak_epochs(int(os.getenv("ECHION_LEAK_EPOCHS", 0)))
+    ec.set_heap_snapshot_signal(bool(int(os.getenv("ECHION_HEAP_SNAPSHOT_SIGNAL", 0))))
     ec.set_native(bool(int(os.getenv("ECHION_NATIVE", 0))))
     ec.set_where(bool(int(os.getenv("ECHION_WHERE", 0) or 0)))
+    ec.set_task_names(os.getenv("ECHION_TASK_NAMES", "raw"))
+    ec.set_format(os.getenv("ECHION_FORMAT", "mojo"))
+    # Leak suspects refer to their stacks by key.
+    ec.set_stack_refs(
+        bool(int(os.getenv("ECHION_STACK_REFS", 0)))
+        or int(os.getenv("ECHION_LEAK_EPOCHS", 0)) > 0
+    )
+    ec.set_compression(int(os.getenv("ECHION_COMPRESSION", -1)))
+    ec.set_compression_flush(int(os.getenv("ECHION_COMPRESSION_FLUSH", 1000)))
+    ec.set_rotation(
+        int(os.getenv("ECHION_ROTATE_SIZE", 0)), int(os.getenv("ECHION_ROTATE_INTERVAL", 0))
+    )
+    ec.set_shm_size(int(os.getenv("ECHION_SHM_SIZE", 16 << 20)))
+    ec.set_socket_queue(int(os.getenv("ECHION_SOCKET_QUEUE", 4 << 20)))
+    ec.set_aggregate(int(os.getenv("ECHION_AGGREGATE", 0)))
+    ec.set_fold(int(os.getenv("ECHION_FOLD", 0)))
+    ec.set_flight_recorder(
+        int(os.getenv("ECHION_FLIGHT_RECORDER", 0)),
+        int(os.getenv("ECHION_FLIGHT_RECORDER_SIZE", 64 << 20)),
+    )
+
+    if int(os.getenv("ECHION_FLIGHT_RECORDER", 0)):
+        install_excepthooks()
 
     # Monkey-patch the standard library on import
     try:
@@ -7,10 +7,23 @@ import typing as t
 
 
 def attach(config: t.Dict[str, str], pipe_name: t.Optional[str] = None) -> None:
+    os.environ["ECHION_AGGREGATE"] = str(config["aggregate"])
+    os.environ["ECHION_COMPRESSION"] = str(config["compress"])
+    os.environ["ECHION_COMPRESSION_FLUSH"] = str(config["compress_flush"])
     os.environ["ECHION_CPU"] = str(int(config["cpu"]))
+    os.environ["ECHION_FLIGHT_RECORDER"] = str(config["flight_recorder"])
+    os.environ["ECHION_FLIGHT_RECORDER_SIZE"] = str(config["flight_recorder_size"])
+    os.environ["ECHION_FOLD"] = str(config["fold"])
+    os.environ["ECHION_FORMAT"] = config["format"]
     os.environ["ECHION_NATIVE"] = str(int(config["native"]))
     os.environ["ECHION_OUTPUT"] = config["output"]
+    os.environ["ECHION_ROTATE_INTERVAL"] = str(config["rotate_interval"])
+    os.environ["ECHION_ROTATE_SIZE"] = str(config["rotate_size"])
+    os.environ["ECHION_SHM_SIZE"] = str(config["shm_size"])
+    os.environ["ECHION_SOCKET_QUEUE"] = str(config["socket_queue"])
+    os.environ["ECHION_STACK_REFS"] = str(int(config["stack_refs"]))
     os.environ["ECHION_STEALTH"] = str(int(config["stealth"]))
+    os.environ["ECHION_TASK_NAMES"] = config["task_names"]
     os.environ["ECHION_WHERE"] = str(int(bool(config["where"])))
 
     from echion.bootstrap import start
@@ -13,6 +13,10 @@
 
 #define CACHE_MAX_ENTRIES 2048
 
+// Task name frames get a cache of their own so that task churn cannot evict
+// code frames.
+#define TASK_CACHE_MAX_ENTRIES 2048
+
 template <typename K, typename V>
 class LRUCache
 {
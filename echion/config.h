@@ -22,6 +22,17 @@ inline bool ignore_non_running_threads = true;
 // Memory events
 inline int memory = 0;
 
+// Mean number of allocated bytes between sampled allocations (0 to track every
+// allocation)
+inline size_t memory_sample_rate = 0;
+
+// Number of flushes over which the live memory of a stack must keep growing
+// for it to be reported as a leak suspect (0 to disable leak detection)
+inline unsigned int leak_epochs = 0;
+
+// Heap snapshots on SIGUSR1
+inline int heap_snapshot_signal = 0;
+
 // Native stack sampling
 inline int native = 0;
 
@@ -34,6 +45,62 @@ inline unsigned int max_frames = 2048;
 // Pipe name (where mode IPC)
 inline std::string pipe_name;
 
+// Task name normalisation
+enum TaskNames
+{
+    TASK_NAMES_RAW,   // Use the task name as is
+    TASK_NAMES_FOLD,  // Strip numeric suffixes, e.g. Task-42 -> Task
+    TASK_NAMES_CORO,  // Use the qualified name of the task coroutine
+};
+
+inline int task_names = TASK_NAMES_RAW;
+
+// Stack interning in the output
+inline int stack_refs = 0;
+
+// Output compression (xz preset, or -1 for no compression)
+inline int compression = -1;
+
+// Interval between flushes of the compressed output, in milliseconds
+inline unsigned int compression_flush = 1000;
+
+// Output rotation thresholds (0 to disable): segment size in bytes, before
+// compression, and segment age in seconds
+inline size_t rotate_size = 0;
+inline unsigned int rotate_interval = 0;
+
+// Size of the data area of the shared memory ring, in bytes (rounded up to a
+// power of two)
+inline size_t shm_size = 16 << 20;
+
+// Maximum number of bytes queued for a socket subscriber before it is
+// disconnected
+inline size_t socket_queue = 4 << 20;
+
+// Output format
+enum OutputFormat
+{
+    OUTPUT_FORMAT_MOJO,       // MOJO samples, as they are taken
+    OUTPUT_FORMAT_PPROF,      // pprof profile, written when the sampler stops
+    OUTPUT_FORMAT_COLLAPSED,  // Folded stacks, for flame graphs
+    OUTPUT_FORMAT_TRACE,      // Trace events, for timelines
+};
+
+inline int output_format = OUTPUT_FORMAT_MOJO;
+
+// Interval between flushes of the aggregated samples, in seconds (0 to emit
+// every sample as it is taken)
+inline unsigned int aggregate = 0;
+
+// Flight recorder window, in seconds (0 to write the output as usual), and
+// memory budget, in bytes
+inline unsigned int flight_recorder = 0;
+inline size_t flight_recorder_size = 64 << 20;
+
+// Longest run of consecutive identical samples of a thread folded into a
+// single one, in seconds (0 to disable folding)
+inline unsigned int fold = 0;
+
 // ----------------------------------------------------------------------------
 static PyObject* set_interval(PyObject* Py_UNUSED(m), PyObject* args)
 {
@@ -82,6 +149,170 @@ static PyObject* set_memory(PyObject* Py_UNUSED(m), PyObject* args)
     Py_RETURN_NONE;
 }
 
+// ----------------------------------------------------------------------------
+static PyObject* set_memory_sample_rate(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned long long new_memory_sample_rate;
+    if (!PyArg_ParseTuple(args, "K", &new_memory_sample_rate))
+        return NULL;
+
+    memory_sample_rate = new_memory_sample_rate;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_leak_epochs(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int new_leak_epochs;
+    if (!PyArg_ParseTuple(args, "I", &new_leak_epochs))
+        return NULL;
+
+    leak_epochs = new_leak_epochs;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_heap_snapshot_signal(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    int new_heap_snapshot_signal;
+    if (!PyArg_ParseTuple(args, "p", &new_heap_snapshot_signal))
+        return NULL;
+
+    heap_snapshot_signal = new_heap_snapshot_signal;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_stack_refs(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    int new_stack_refs;
+    if (!PyArg_ParseTuple(args, "p", &new_stack_refs))
+        return NULL;
+
+    stack_refs = new_stack_refs;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_compression(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    int new_compression;
+    if (!PyArg_ParseTuple(args, "i", &new_compression))
+        return NULL;
+
+    if (new_compression < -1 || new_compression > 9)
+    {
+        PyErr_Format(PyExc_ValueError, "Invalid compression preset: %d", new_compression);
+        return NULL;
+    }
+
+#ifdef LZMA_DISABLE
+    if (new_compression >= 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Output compression is disabled, please re-build/install echion "
+                        "with liblzma support");
+        return NULL;
+    }
+#endif
+
+    compression = new_compression;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_compression_flush(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int new_compression_flush;
+    if (!PyArg_ParseTuple(args, "I", &new_compression_flush))
+        return NULL;
+
+    compression_flush = new_compression_flush;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_rotation(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned long long new_rotate_size;
+    unsigned int new_rotate_interval;
+    if (!PyArg_ParseTuple(args, "KI", &new_rotate_size, &new_rotate_interval))
+        return NULL;
+
+    rotate_size = new_rotate_size;
+    rotate_interval = new_rotate_interval;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_shm_size(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned long long new_shm_size;
+    if (!PyArg_ParseTuple(args, "K", &new_shm_size))
+        return NULL;
+
+    shm_size = new_shm_size;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_socket_queue(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned long long new_socket_queue;
+    if (!PyArg_ParseTuple(args, "K", &new_socket_queue))
+        return NULL;
+
+    socket_queue = new_socket_queue;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_flight_recorder(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int new_flight_recorder;
+    unsigned long long new_flight_recorder_size;
+    if (!PyArg_ParseTuple(args, "IK", &new_flight_recorder, &new_flight_recorder_size))
+        return NULL;
+
+    flight_recorder = new_flight_recorder;
+    flight_recorder_size = new_flight_recorder_size;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_fold(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int new_fold;
+    if (!PyArg_ParseTuple(args, "I", &new_fold))
+        return NULL;
+
+    fold = new_fold;
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_aggregate(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    unsigned int new_aggregate;
+    if (!PyArg_ParseTuple(args, "I", &new_aggregate))
+        return NULL;
+
+    aggregate = new_aggregate;
+
+    Py_RETURN_NONE;
+}
+
 // ----------------------------------------------------------------------------
 static PyObject* set_native(PyObject* Py_UNUSED(m), PyObject* args)
 {
@@ -124,6 +355,54 @@ static PyObject* set_pipe_name(PyObject* Py_UNUSED(m), PyObject* args)
     Py_RETURN_NONE;
 }
 
+// ----------------------------------------------------------------------------
+static PyObject* set_task_names(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    const char* mode;
+    if (!PyArg_ParseTuple(args, "s", &mode))
+        return NULL;
+
+    std::string value(mode);
+    if (value == "raw")
+        task_names = TASK_NAMES_RAW;
+    else if (value == "fold")
+        task_names = TASK_NAMES_FOLD;
+    else if (value == "coro")
+        task_names = TASK_NAMES_CORO;
+    else
+    {
+        PyErr_Format(PyExc_ValueError, "Invalid task names mode: %s", mode);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* set_format(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    const char* format;
+    if (!PyArg_ParseTuple(args, "s", &format))
+        return NULL;
+
+    std::string value(format);
+    if (value == "mojo")
+        output_format = OUTPUT_FORMAT_MOJO;
+    else if (value == "pprof")
+        output_format = OUTPUT_FORMAT_PPROF;
+    else if (value == "collapsed")
+        output_format = OUTPUT_FORMAT_COLLAPSED;
+    else if (value == "trace")
+        output_format = OUTPUT_FORMAT_TRACE;
+    else
+    {
+        PyErr_Format(PyExc_ValueError, "Invalid output format: %s", format);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
 // ----------------------------------------------------------------------------
 static PyObject* set_max_frames(PyObject* Py_UNUSED(m), PyObject* args)
 {
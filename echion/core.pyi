@@ -11,6 +11,8 @@ if t.TYPE_CHECKING:
 def start() -> None: ...
 def start_async() -> None: ...
 def stop() -> None: ...
+def dump(path: str | None = None) -> str: ...
+def heap_snapshot(path: str | None = None) -> str: ...
 def track_thread(thread_id: int, name: str, native_id: int) -> None: ...
 def untrack_thread(thread_id: int) -> None: ...
 
@@ -34,7 +36,20 @@ def update_greenlet_frame(greenlet_id: int, frame: FrameType | bool | None) -> N
 def set_interval(interval: int) -> None: ...
 def set_cpu(cpu: bool) -> None: ...
 def set_memory(memory: bool) -> None: ...
+def set_memory_sample_rate(rate: int) -> None: ...
+def set_leak_epochs(epochs: int) -> None: ...
 def set_native(native: bool) -> None: ...
 def set_where(where: bool) -> None: ...
 def set_pipe_name(name: str) -> None: ...
+def set_format(format: str) -> None: ...
 def set_max_frames(max_frames: int) -> None: ...
+def set_task_names(mode: str) -> None: ...
+def set_stack_refs(stack_refs: bool) -> None: ...
+def set_compression(preset: int) -> None: ...
+def set_compression_flush(interval: int) -> None: ...
+def set_rotation(size: int, interval: int) -> None: ...
+def set_shm_size(size: int) -> None: ...
+def set_socket_queue(size: int) -> None: ...
+def set_fold(interval: int) -> None: ...
+def set_aggregate(interval: int) -> None: ...
+def set_flight_recorder(window: int, size: int) -> None: ...
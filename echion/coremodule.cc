@@ -145,6 +145,8 @@ static inline void _start()
     if (memory)
     {
         Renderer::get().metadata("mode", "memory");
+        if (memory_sample_rate > 0)
+            Renderer::get().metadata("memory_sample_rate", std::to_string(memory_sample_rate));
     }
     else
     {
@@ -181,6 +183,8 @@ static inline void _stop()
         string_table.clear();
     }
 
+    stack_table.clear();
+
     teardown_where();
 
 #if defined PL_DARWIN
@@ -208,10 +212,26 @@ static inline void _sampler()
         microsecond_t now = gettime();
         microsecond_t end_time = now + interval;
 
+        sample_time = now;
+
+        Renderer::get().pin();
+
         if (memory)
         {
+            allocation_events.drain();
+
             if (rss_tracker.check())
                 stack_stats.flush();
+
+            if (heap_snapshot_requested.exchange(false))
+            {
+                auto snapshot_path = heap_snapshot(nullptr);
+                if (snapshot_path)
+                    std::cerr << "echion: heap snapshot written to " << *snapshot_path
+                              << std::endl;
+                else
+                    std::cerr << "echion: failed to take a heap snapshot" << std::endl;
+            }
         }
         else
         {
@@ -228,6 +248,17 @@ static inline void _sampler()
             });
         }
 
+        Renderer::get().unpin();
+
+        if (dump_requested.exchange(false))
+        {
+            auto dump_path = Renderer::get().dump(nullptr);
+            if (dump_path)
+                std::cerr << "echion: flight recorder dumped to " << *dump_path << std::endl;
+            else
+                std::cerr << "echion: failed to dump the flight recorder" << std::endl;
+        }
+
         std::this_thread::sleep_for(std::chrono::microseconds(end_time - now));
         last_time = now;
     }
@@ -296,6 +327,50 @@ static PyObject* stop(PyObject* Py_UNUSED(m), PyObject* Py_UNUSED(args))
     Py_RETURN_NONE;
 }
 
+// ----------------------------------------------------------------------------
+static PyObject* dump(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    const char* path = nullptr;
+    if (!PyArg_ParseTuple(args, "|z", &path))
+        return NULL;
+
+    Result<std::string> dump_path = ErrorKind::RendererError;
+
+    Py_BEGIN_ALLOW_THREADS;
+    dump_path = Renderer::get().dump(path);
+    Py_END_ALLOW_THREADS;
+
+    if (!dump_path)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to dump the flight recorder");
+        return NULL;
+    }
+
+    return PyUnicode_FromString(dump_path->c_str());
+}
+
+// ----------------------------------------------------------------------------
+static PyObject* heap_snapshot(PyObject* Py_UNUSED(m), PyObject* args)
+{
+    const char* path = nullptr;
+    if (!PyArg_ParseTuple(args, "|z", &path))
+        return NULL;
+
+    Result<std::string> snapshot_path = ErrorKind::RendererError;
+
+    Py_BEGIN_ALLOW_THREADS;
+    snapshot_path = ::heap_snapshot(path);
+    Py_END_ALLOW_THREADS;
+
+    if (!snapshot_path)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to take a heap snapshot");
+        return NULL;
+    }
+
+    return PyUnicode_FromString(snapshot_path->c_str());
+}
+
 // ----------------------------------------------------------------------------
 static PyObject* track_thread(PyObject* Py_UNUSED(m), PyObject* args)
 {
@@ -511,6 +586,9 @@ static PyMethodDef echion_core_methods[] = {
     {"start", start, METH_NOARGS, "Start the stack sampler"},
     {"start_async", start_async, METH_NOARGS, "Start the stack sampler asynchronously"},
     {"stop", stop, METH_NOARGS, "Stop the stack sampler"},
+    {"dump", dump, METH_VARARGS, "Dump the samples held by the flight recorder"},
+    {"heap_snapshot", heap_snapshot, METH_VARARGS,
+     "Write the live memory by allocation stack, in memory mode"},
     {"track_thread", track_thread, METH_VARARGS, "Map the name of a thread with its identifier"},
     {"untrack_thread", untrack_thread, METH_VARARGS, "Untrack a terminated thread"},
     {"init", init, METH_NOARGS, "Initialize the stack sampler (usually after a fork)"},
@@ -529,10 +607,33 @@ static PyMethodDef echion_core_methods[] = {
     {"set_interval", set_interval, METH_VARARGS, "Set the sampling interval"},
     {"set_cpu", set_cpu, METH_VARARGS, "Set whether to use CPU time instead of wall time"},
     {"set_memory", set_memory, METH_VARARGS, "Set whether to sample memory usage"},
+    {"set_memory_sample_rate", set_memory_sample_rate, METH_VARARGS,
+     "Set the mean number of bytes between sampled allocations"},
+    {"set_leak_epochs", set_leak_epochs, METH_VARARGS,
+     "Set the number of flushes of growing memory that make a leak suspect"},
+    {"set_heap_snapshot_signal", set_heap_snapshot_signal, METH_VARARGS,
+     "Set whether to take heap snapshots on SIGUSR1"},
     {"set_native", set_native, METH_VARARGS, "Set whether to sample the native stacks"},
     {"set_where", set_where, METH_VARARGS, "Set whether to use where mode"},
     {"set_pipe_name", set_pipe_name, METH_VARARGS, "Set the pipe name"},
+    {"set_format", set_format, METH_VARARGS, "Set the output format"},
     {"set_max_frames", set_max_frames, METH_VARARGS, "Set the max number of frames to unwind"},
+    {"set_task_names", set_task_names, METH_VARARGS, "Set how to normalise asyncio task names"},
+    {"set_stack_refs", set_stack_refs, METH_VARARGS, "Set whether to intern stacks in the output"},
+    {"set_compression", set_compression, METH_VARARGS, "Set the xz preset for the output"},
+    {"set_compression_flush", set_compression_flush, METH_VARARGS,
+     "Set the interval between compressed output flushes"},
+    {"set_rotation", set_rotation, METH_VARARGS, "Set the output rotation size and interval"},
+    {"set_shm_size", set_shm_size, METH_VARARGS,
+     "Set the size of the shared memory output ring"},
+    {"set_socket_queue", set_socket_queue, METH_VARARGS,
+     "Set the maximum size of the send queue of socket subscribers"},
+    {"set_fold", set_fold, METH_VARARGS,
+     "Set the longest run of identical samples folded into one"},
+    {"set_aggregate", set_aggregate, METH_VARARGS,
+     "Set the interval between flushes of the aggregated samples"},
+    {"set_flight_recorder", set_flight_recorder, METH_VARARGS,
+     "Set the flight recorder window and memory budget"},
     // Sentinel
     {NULL, NULL, 0, NULL}};
 
@@ -33,6 +33,7 @@ static inline int _read_signed_varint(unsigned char* table, ssize_t size, ssize_
 void init_frame_cache(size_t capacity)
 {
     frame_cache = new LRUCache<uintptr_t, Frame>(capacity);
+    task_frame_cache = new LRUCache<uintptr_t, Frame>(TASK_CACHE_MAX_ENTRIES);
 }
 
 // ----------------------------------------------------------------------------
@@ -40,6 +41,9 @@ void reset_frame_cache()
 {
     delete frame_cache;
     frame_cache = nullptr;
+
+    delete task_frame_cache;
+    task_frame_cache = nullptr;
 }
 
 // ------------------------------------------------------------------------
@@ -482,7 +486,7 @@ Frame& Frame::get(StringTable::Key name)
 {
     uintptr_t frame_key = static_cast<uintptr_t>(name);
 
-    auto maybe_frame = frame_cache->lookup(frame_key);
+    auto maybe_frame = task_frame_cache->lookup(frame_key);
     if (maybe_frame)
     {
         return *maybe_frame;
@@ -494,6 +498,6 @@ Frame& Frame::get(StringTable::Key name)
     Renderer::get().frame(frame_key, frame->filename, frame->name, frame->location.line,
                           frame->location.line_end, frame->location.column,
                           frame->location.column_end);
-    frame_cache->store(frame_key, std::move(frame));
+    task_frame_cache->store(frame_key, std::move(frame));
     return f;
 }
@@ -105,5 +105,6 @@ inline auto C_FRAME = Frame(StringTable::C_FRAME);
 // We make this a raw pointer to prevent its destruction on exit, since we
 // control the lifetime of the cache.
 inline LRUCache<uintptr_t, Frame>* frame_cache = nullptr;
+inline LRUCache<uintptr_t, Frame>* task_frame_cache = nullptr;
 void init_frame_cache(size_t capacity);
 void reset_frame_cache();
@@ -0,0 +1,217 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// A small gzip encoder, so that we don't need to link against zlib. The data
+// is compressed with greedy LZ77 matching and the fixed Huffman codes of
+// DEFLATE (RFC 1951) in a single block. This is nowhere near as good as zlib,
+// but it gets most of the gain on the highly repetitive data we produce.
+class GzipEncoder
+{
+public:
+    // ------------------------------------------------------------------------
+    static std::string compress(const std::string& data)
+    {
+        GzipEncoder encoder;
+
+        // Header: magic, deflate, no flags, no mtime, no extra flags, unknown OS.
+        static const char header[] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff'};
+        encoder.output.append(header, sizeof(header));
+
+        encoder.deflate(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+
+        encoder.u32(crc32(data));
+        encoder.u32(static_cast<uint32_t>(data.size()));
+
+        return std::move(encoder.output);
+    }
+
+    // ------------------------------------------------------------------------
+    static uint32_t crc32(const std::string& data)
+    {
+        static const auto table = [] {
+            std::vector<uint32_t> table(256);
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+            return table;
+        }();
+
+        uint32_t crc = 0xffffffff;
+        for (auto c : data)
+            crc = table[(crc ^ static_cast<uint8_t>(c)) & 0xff] ^ (crc >> 8);
+
+        return crc ^ 0xffffffff;
+    }
+
+private:
+    static constexpr size_t WINDOW_SIZE = 1 << 15;
+    static constexpr size_t HASH_BITS = 15;
+    static constexpr size_t MIN_MATCH = 3;
+    static constexpr size_t MAX_MATCH = 258;
+    static constexpr int MAX_CHAIN = 64;
+
+    std::string output;
+    uint64_t bits = 0;
+    int bit_count = 0;
+
+    // ------------------------------------------------------------------------
+    void u32(uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            output.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+
+    // ------------------------------------------------------------------------
+    // Bits are packed starting from the least significant bit of each byte.
+    void put_bits(uint32_t value, int count)
+    {
+        bits |= static_cast<uint64_t>(value) << bit_count;
+        bit_count += count;
+        while (bit_count >= 8)
+        {
+            output.push_back(static_cast<char>(bits & 0xff));
+            bits >>= 8;
+            bit_count -= 8;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Huffman codes are packed starting from their most significant bit.
+    void put_code(uint32_t code, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++)
+            reversed |= ((code >> i) & 1) << (length - 1 - i);
+
+        put_bits(reversed, length);
+    }
+
+    // ------------------------------------------------------------------------
+    void literal(unsigned int value)
+    {
+        if (value < 144)
+            put_code(0x30 + value, 8);
+        else if (value < 256)
+            put_code(0x190 + value - 144, 9);
+        else if (value < 280)
+            put_code(value - 256, 7);
+        else
+            put_code(0xc0 + value - 280, 8);
+    }
+
+    // ------------------------------------------------------------------------
+    void match(size_t length, size_t distance)
+    {
+        static const uint16_t length_base[] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,
+                                               15, 17, 19, 23, 27, 31, 35, 43, 51,  59,
+                                               67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const uint8_t length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                               2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const uint16_t distance_base[] = {
+            1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+            193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const uint8_t distance_extra[] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,  4,  4,  5,  5,  6,
+                                                 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        int code = 28;
+        while (length_base[code] > length)
+            code--;
+        literal(257 + code);
+        put_bits(static_cast<uint32_t>(length - length_base[code]), length_extra[code]);
+
+        code = 29;
+        while (distance_base[code] > distance)
+            code--;
+        put_code(code, 5);
+        put_bits(static_cast<uint32_t>(distance - distance_base[code]), distance_extra[code]);
+    }
+
+    // ------------------------------------------------------------------------
+    static inline uint32_t hash(const uint8_t* p)
+    {
+        uint32_t value = p[0] | (p[1] << 8) | (p[2] << 16);
+        return (value * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // ------------------------------------------------------------------------
+    void deflate(const uint8_t* data, size_t size)
+    {
+        // A single, final block with fixed Huffman codes.
+        put_bits(1, 1);
+        put_bits(1, 2);
+
+        std::vector<int64_t> head(1 << HASH_BITS, -1);
+        std::vector<int64_t> prev(size, -1);
+
+        size_t i = 0;
+        while (i < size)
+        {
+            size_t best_length = 0;
+            size_t best_distance = 0;
+
+            if (i + MIN_MATCH <= size)
+            {
+                auto h = hash(data + i);
+                auto limit = size - i < MAX_MATCH ? size - i : MAX_MATCH;
+
+                int chain = MAX_CHAIN;
+                for (auto candidate = head[h];
+                     candidate >= 0 && i - candidate <= WINDOW_SIZE && chain-- > 0;
+                     candidate = prev[candidate])
+                {
+                    size_t length = 0;
+                    while (length < limit && data[candidate + length] == data[i + length])
+                        length++;
+
+                    if (length > best_length)
+                    {
+                        best_length = length;
+                        best_distance = i - candidate;
+                        if (length == limit)
+                            break;
+                    }
+                }
+            }
+
+            size_t advance = 1;
+            if (best_length >= MIN_MATCH)
+            {
+                match(best_length, best_distance);
+                advance = best_length;
+            }
+            else
+            {
+                literal(data[i]);
+            }
+
+            // Index every position we move past so that later matches can
+            // refer to them.
+            for (size_t end = i + advance; i < end; i++)
+            {
+                if (i + MIN_MATCH <= size)
+                {
+                    auto h = hash(data + i);
+                    prev[i] = head[h];
+                    head[h] = i;
+                }
+            }
+        }
+
+        // End of block, then pad to a byte boundary.
+        literal(256);
+        if (bit_count > 0)
+            put_bits(0, 8 - bit_count);
+    }
+};
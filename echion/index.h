@@ -0,0 +1,159 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <echion/mojo.h>
+#include <echion/sink.h>
+
+// ----------------------------------------------------------------------------
+// Index of a MOJO file, written at its end so that readers can seek to what
+// they need rather than scanning the whole file. Offsets are in bytes from the
+// start of the (uncompressed) MOJO stream, and always fall on the start of a
+// record, i.e. of a complete event or sample.
+//
+// The index is made of metadata events, so readers that do not know about it
+// just see a few more metadata entries. These are
+//
+//   index_definitions  OFFSET+SIZE ...  blocks of header, metadata and
+//                                       definitions
+//   index_times        MS@OFFSET ...    first sample written at or after the
+//                                       given Unix time, in milliseconds, about
+//                                       every second
+//   index_thread       FIRST-LAST NAME  first and last sample of the named
+//                                       thread, once for each thread
+//
+// The file then ends with the index_offset metadata event, whose value is the
+// offset of the first index event, as a fixed-width decimal number. Readers
+// can thus find the index by reading the last INDEX_TRAILER_SIZE bytes.
+#define INDEX_OFFSET_DIGITS 20
+#define INDEX_TRAILER_SIZE (1 + sizeof("index_offset") + INDEX_OFFSET_DIGITS + 1)
+
+class MojoIndex
+{
+public:
+    // ------------------------------------------------------------------------
+    inline void clear()
+    {
+        definitions.clear();
+        times.clear();
+        threads.clear();
+        next_time = 0;
+    }
+
+    // ------------------------------------------------------------------------
+    void add(size_t offset, size_t size, RecordKind kind, std::string_view thread)
+    {
+        switch (kind)
+        {
+        case RECORD_DEFINITION:
+            // Coalesce adjacent definitions into blocks.
+            if (!definitions.empty() &&
+                definitions.back().first + definitions.back().second == offset)
+                definitions.back().second += size;
+            else
+                definitions.emplace_back(offset, size);
+            break;
+
+        case RECORD_SAMPLE:
+        case RECORD_SAMPLES:
+        {
+            auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+            if (now >= next_time)
+            {
+                times.emplace_back(now, offset);
+                next_time = now + TIME_RESOLUTION;
+            }
+
+            if (kind == RECORD_SAMPLE)
+            {
+                auto entry = threads.find(thread);
+                if (entry == threads.end())
+                    threads.emplace(thread, std::make_pair(offset, offset));
+                else
+                    entry->second.second = offset;
+            }
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // The index events, to be written at the given offset.
+    MojoBuffer footer(size_t offset) const
+    {
+        MojoBuffer buffer;
+        char entry[64];
+        std::string value;
+
+        for (auto& [start, size] : definitions)
+        {
+            std::snprintf(entry, sizeof(entry), "%zu+%zu ", start, size);
+            value += entry;
+        }
+        metadata(buffer, "index_definitions", value);
+
+        value.clear();
+        for (auto& [time, start] : times)
+        {
+            std::snprintf(entry, sizeof(entry), "%lld@%zu ", static_cast<long long>(time), start);
+            value += entry;
+        }
+        metadata(buffer, "index_times", value);
+
+        for (auto& [thread, range] : threads)
+        {
+            std::snprintf(entry, sizeof(entry), "%zu-%zu ", range.first, range.second);
+            value = entry;
+            value += thread;
+            metadata(buffer, "index_thread", value.c_str());
+        }
+
+        std::snprintf(entry, sizeof(entry), "%0*zu", INDEX_OFFSET_DIGITS, offset);
+        metadata(buffer, "index_offset", entry);
+
+        return buffer;
+    }
+
+private:
+    static constexpr long long TIME_RESOLUTION = 1000;
+
+    std::vector<std::pair<size_t, size_t>> definitions;
+    std::vector<std::pair<long long, size_t>> times;
+    std::map<std::string, std::pair<size_t, size_t>, std::less<>> threads;
+    long long next_time = 0;
+
+    // ------------------------------------------------------------------------
+    static void metadata(MojoBuffer& buffer, const char* label, std::string& value)
+    {
+        // Drop the trailing separator.
+        if (!value.empty() && value.back() == ' ')
+            value.pop_back();
+
+        buffer.event(MOJO_METADATA);
+        buffer.string(label);
+        buffer.string(value);
+    }
+
+    static void metadata(MojoBuffer& buffer, const char* label, const char* value)
+    {
+        buffer.event(MOJO_METADATA);
+        buffer.string(label);
+        buffer.string(value);
+    }
+};
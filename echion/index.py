@@ -0,0 +1,93 @@
+# This file is part of "echion" which is released under MIT.
+#
+# Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+"""Reader for the index at the end of MOJO files.
+
+The format of the index is documented in echion/index.h. Offsets are in bytes
+from the start of the uncompressed MOJO stream, so they can be used to seek
+into uncompressed files only.
+"""
+
+import bisect
+import os
+import typing as t
+from dataclasses import dataclass
+from dataclasses import field
+
+MOJO_METADATA = 1
+
+OFFSET_DIGITS = 20
+TRAILER = b"\x01index_offset\x00"
+TRAILER_SIZE = len(TRAILER) + OFFSET_DIGITS + 1
+
+
+@dataclass
+class MojoIndex:
+    definitions: t.List[t.Tuple[int, int]] = field(default_factory=list)
+    times: t.List[t.Tuple[int, int]] = field(default_factory=list)
+    threads: t.Dict[str, t.Tuple[int, int]] = field(default_factory=dict)
+    offset: int = 0
+
+    def seek_time(self, ms: int) -> int:
+        """Offset of the first sample written at or after the given time."""
+        i = bisect.bisect_left(self.times, (ms, -1))
+        if i >= len(self.times):
+            return self.offset
+        return self.times[i][1]
+
+
+def _string(data: bytes, i: int) -> t.Tuple[bytes, int]:
+    end = data.index(b"\x00", i)
+    return data[i:end], end + 1
+
+
+def _entries(value: bytes) -> t.Iterator[str]:
+    return iter(value.decode().split())
+
+
+def read_index(path: str) -> t.Optional[MojoIndex]:
+    """Read the index of a MOJO file, if it has one."""
+    with open(path, "rb") as f:
+        size = f.seek(0, os.SEEK_END)
+        if size < TRAILER_SIZE:
+            return None
+
+        f.seek(size - TRAILER_SIZE)
+        trailer = f.read(TRAILER_SIZE)
+        if not trailer.startswith(TRAILER):
+            return None
+
+        offset = int(trailer[len(TRAILER) : -1])
+        f.seek(offset)
+        events = f.read(size - TRAILER_SIZE - offset)
+
+    index = MojoIndex(offset=offset)
+
+    # Each event is the event byte followed by the label and the value, as
+    # null-terminated strings. Values, e.g. thread names, can contain any other
+    # byte, so the events are read one after the other.
+    i = 0
+    while i < len(events):
+        if events[i] != MOJO_METADATA:
+            raise ValueError(f"Unexpected MOJO event {events[i]} in the index")
+
+        label, i = _string(events, i + 1)
+        value, i = _string(events, i)
+
+        if label == b"index_definitions":
+            for entry in _entries(value):
+                start, _, length = entry.partition("+")
+                index.definitions.append((int(start), int(length)))
+
+        elif label == b"index_times":
+            for entry in _entries(value):
+                ms, _, start = entry.partition("@")
+                index.times.append((int(ms), int(start)))
+
+        elif label == b"index_thread":
+            span, _, name = value.decode().partition(" ")
+            first, _, last = span.partition("-")
+            index.threads[name] = (int(first), int(last))
+
+    return index
@@ -0,0 +1,235 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <echion/errors.h>
+#include <echion/index.h>
+#include <echion/mojo.h>
+#include <echion/sink.h>
+
+// ----------------------------------------------------------------------------
+// Crash-durable output layout. The MOJO stream is copied into a shared memory
+// mapping of the output file, so everything that has been written is in the
+// page cache, and makes it to the file, even if the process is killed. The
+// file starts with a header page, followed by the MOJO stream.
+//
+//   offset  size  field
+//        0     8  magic, "ECHOMMAP"
+//        8     4  version of the layout, currently 1
+//       12     4  offset of the MOJO stream from the start of the file
+//       16     8  committed length of the MOJO stream
+//       24     4  state: 1 open, 2 closed
+//
+// The committed length is updated after each record, i.e. each complete
+// event or sample, is copied, so anything past it is a torn record that must
+// be ignored. The file is grown, and space reserved on disk, in large steps,
+// and is truncated to the committed length when the output is closed.
+struct MappedFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t data_offset;
+    std::atomic<uint64_t> committed;
+    std::atomic<uint32_t> state;
+};
+
+// ----------------------------------------------------------------------------
+class MappedFileWriter : public OutputSink
+{
+public:
+    static constexpr const char* SCHEME = "mmap:";
+
+    enum State
+    {
+        STATE_OPEN = 1,
+        STATE_CLOSED = 2,
+    };
+
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Result<void> open(const char* output) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        path = output + std::strlen(SCHEME);
+
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return ErrorKind::RendererError;
+
+        length = 0;
+        dropped = 0;
+        index.clear();
+        owner = getpid();
+
+        if (!grow(INITIAL_SIZE))
+        {
+            ::close(fd);
+            fd = -1;
+            return ErrorKind::RendererError;
+        }
+
+        header = new (mapping) MappedFileHeader();
+        std::memcpy(header->magic, "ECHOMMAP", sizeof(header->magic));
+        header->version = 1;
+        header->data_offset = HEADER_SIZE;
+        header->committed.store(0, std::memory_order_relaxed);
+        header->state.store(STATE_OPEN, std::memory_order_release);
+
+        return Result<void>::ok();
+    }
+
+    // ------------------------------------------------------------------------
+    void close() override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (mapping == nullptr)
+            return;
+
+        auto footer = index.footer(length);
+        append(footer.data(), footer.size());
+
+        header->state.store(STATE_CLOSED, std::memory_order_release);
+
+        munmap(mapping, size);
+        mapping = nullptr;
+        header = nullptr;
+
+        if (ftruncate(fd, HEADER_SIZE + length) != 0)
+        {
+            // The reader goes by the committed length anyway.
+        }
+        ::close(fd);
+        fd = -1;
+    }
+
+    // ------------------------------------------------------------------------
+    bool write(const char* data, size_t data_size, RecordKind kind,
+               std::string_view thread_name) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (mapping == nullptr)
+            return false;
+
+        auto offset = length;
+        if (!append(data, data_size))
+        {
+            dropped++;
+            return false;
+        }
+
+        index.add(offset, data_size, kind, thread_name);
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool needs_preamble() const override
+    {
+        return false;
+    }
+
+    bool restart_due() override
+    {
+        return false;
+    }
+
+    void restart(const MojoBuffer&) override {}
+
+    // ------------------------------------------------------------------------
+    size_t dropped_records() override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        return dropped;
+    }
+
+    // ------------------------------------------------------------------------
+    bool forked() const override
+    {
+        return owner != 0 && owner != getpid();
+    }
+
+private:
+    static constexpr size_t HEADER_SIZE = 4096;
+    static constexpr size_t INITIAL_SIZE = 16 << 20;
+    static constexpr size_t MAX_GROWTH = 256 << 20;
+
+    std::string path;
+    int fd = -1;
+    char* mapping = nullptr;
+    size_t size = 0;  // Of the file, and the mapping
+    MappedFileHeader* header = nullptr;
+
+    size_t length = 0;  // Of the MOJO stream
+    size_t dropped = 0;
+    MojoIndex index;
+    pid_t owner = 0;
+
+    std::mutex lock;
+
+    // ------------------------------------------------------------------------
+    // Grow the file to the given size, and map it again. The space is
+    // reserved on disk, as running out of it while writing to the mapping
+    // would kill the process.
+    bool grow(size_t new_size)
+    {
+#if defined PL_LINUX
+        if (posix_fallocate(fd, 0, new_size) != 0)
+            return false;
+#else
+        if (ftruncate(fd, new_size) != 0)
+            return false;
+#endif
+
+        auto* new_mapping = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (new_mapping == MAP_FAILED)
+            return false;
+
+        if (mapping != nullptr)
+            munmap(mapping, size);
+
+        mapping = static_cast<char*>(new_mapping);
+        header = reinterpret_cast<MappedFileHeader*>(mapping);
+        size = new_size;
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool append(const char* data, size_t data_size)
+    {
+        auto needed = HEADER_SIZE + length + data_size;
+        if (needed > size)
+        {
+            auto new_size = size;
+            while (new_size < needed)
+                new_size += new_size < MAX_GROWTH ? new_size : MAX_GROWTH;
+
+            if (!grow(new_size))
+                return false;
+        }
+
+        std::memcpy(mapping + HEADER_SIZE + length, data, data_size);
+        length += data_size;
+
+        // Publish the record only once it has been copied in full.
+        header->committed.store(length, std::memory_order_release);
+
+        return true;
+    }
+};
@@ -6,10 +6,22 @@
 
 #include <Python.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
 #include <optional>
 #include <unordered_map>
+#include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <unistd.h>
 
 #include <echion/config.h>
 #include <echion/interp.h>
@@ -21,7 +33,7 @@
 class ResidentMemoryTracker
 {
 public:
-    size_t size;
+    size_t size = 0;  // The peak resident set size so far
 
     // ------------------------------------------------------------------------
     ResidentMemoryTracker()
@@ -41,14 +53,111 @@ private:
     // ------------------------------------------------------------------------
     void inline update()
     {
+#if defined PL_LINUX
+        // The peak that getrusage reports is carried over from the parent
+        // across fork and exec, so a process started by a larger one would
+        // not see its own growth. We keep track of the peak ourselves.
+        size = std::max(size, resident_pages());
+#else
         struct rusage usage;
         getrusage(RUSAGE_SELF, &usage);
         size = usage.ru_maxrss;
+#endif
+    }
+
+#if defined PL_LINUX
+    // ------------------------------------------------------------------------
+    static size_t resident_pages()
+    {
+        // Opened every time, as /proc/self would still be the parent after a
+        // fork.
+        auto fd = open("/proc/self/statm", O_RDONLY);
+        if (fd < 0)
+            return 0;
+
+        char buffer[128];
+        auto n = read(fd, buffer, sizeof(buffer) - 1);
+        close(fd);
+        if (n <= 0)
+            return 0;
+        buffer[n] = '\0';
+
+        // The total program size, then the resident set size, in pages.
+        char* end;
+        std::strtoull(buffer, &end, 10);
+        return std::strtoull(end, nullptr, 10);
     }
+#endif
 };
 
 inline ResidentMemoryTracker rss_tracker;
 
+// ----------------------------------------------------------------------------
+// Allocations are stamped with the number of flushes of the stack stats, i.e.
+// the epoch, at the time they are made, so that the age of the surviving ones
+// can be told.
+inline std::atomic<uint32_t> memory_epoch = 0;
+
+// ----------------------------------------------------------------------------
+// Live bytes of a stack by age, in epochs, of the allocations. The recent
+// epochs are tracked one by one, in slots indexed by the epoch, and are merged
+// into a single bucket as they age past the last slot.
+class AgeHistogram
+{
+public:
+    static constexpr uint32_t RECENT = 7;
+
+    // ------------------------------------------------------------------------
+    void inline add(uint32_t allocation_epoch, int64_t size)
+    {
+        advance();
+
+        if (epoch - allocation_epoch < RECENT)
+            recent[allocation_epoch % RECENT] += size;
+        else
+            old += size;
+    }
+
+    // ------------------------------------------------------------------------
+    // Live bytes allocated the given number of epochs ago, or longer ago for
+    // the last bucket.
+    int64_t inline bucket(uint32_t age) const
+    {
+        return age < RECENT ? recent[(epoch - age) % RECENT] : old;
+    }
+
+    // ------------------------------------------------------------------------
+    int64_t inline live_since(uint32_t age) const
+    {
+        int64_t total = old;
+        for (; age < RECENT; age++)
+            total += bucket(age);
+        return total;
+    }
+
+    // ------------------------------------------------------------------------
+    // Move the allocations that have aged past the last slot to the old
+    // bucket.
+    void inline advance()
+    {
+        auto now = memory_epoch.load(std::memory_order_relaxed);
+
+        for (uint32_t i = 0; epoch != now && i < RECENT; i++)
+        {
+            epoch++;
+            old += recent[epoch % RECENT];
+            recent[epoch % RECENT] = 0;
+        }
+
+        epoch = now;
+    }
+
+private:
+    int64_t recent[RECENT] = {};
+    int64_t old = 0;
+    uint32_t epoch = 0;  // The epoch of the youngest slot
+};
+
 // ----------------------------------------------------------------------------
 
 class MemoryStats
@@ -62,6 +171,13 @@ public:
     size_t count;
     ssize_t size;
 
+    // Live bytes by age, and the number of flushes at which they have reached
+    // a new high since they last started growing, for leak detection
+    AgeHistogram ages;
+    int64_t baseline = 0;
+    int64_t high = 0;
+    uint32_t growing = 0;
+
     // ------------------------------------------------------------------------
     MemoryStats(int iid, std::string thread_name, FrameStack::Key stack, size_t count, size_t size)
         : iid(iid), thread_name(thread_name), stack(stack), count(count), size(size)
@@ -71,11 +187,63 @@ public:
     // ------------------------------------------------------------------------
     void inline render()
     {
-        Renderer::get().render_stack_begin(pid, iid, thread_name);
+        SampleView sample;
+        sample.pid = pid;
+        sample.iid = iid;
+        sample.thread_name = &thread_name;
+        sample.metric_type = MetricType::Memory;
+        sample.delta = size;
+
+        stack_table.view(stack, sample);
+
+        Renderer::get().render_sample(sample);
+    }
+
+    // ------------------------------------------------------------------------
+    // Called once per flush. A stack is a leak suspect when its live bytes
+    // have reached a new high at the given number of flushes, not necessarily
+    // consecutive ones, without going back to where they started growing
+    // from, while it still holds on to allocations made at least as many
+    // epochs ago. Ages are only told apart up to RECENT epochs, so that is as
+    // old as the allocations need to be for larger numbers of flushes.
+    // Suspects are reported when they become so, and then again every time
+    // the growth has gone on for twice as long.
+    void inline check_leak(uint32_t epochs)
+    {
+        ages.advance();
+
+        auto live = ages.live_since(0);
+        if (live <= baseline)
+        {
+            growing = 0;
+            baseline = high = live;
+            return;
+        }
+
+        if (live <= high)
+            return;
+
+        growing++;
+        high = live;
+
+        auto periods = growing / epochs;
+        if (growing % epochs != 0 || (periods & (periods - 1)) != 0)
+            return;
 
-        stack_table.retrieve(stack).render();
+        if (ages.live_since(std::min(epochs, AgeHistogram::RECENT)) <= 0)
+            return;
 
-        Renderer::get().render_stack_end(MetricType::Memory, size);
+        std::string value = std::to_string(stack) + " " + std::to_string(live) + " " +
+                            std::to_string(growing) + " ";
+        for (uint32_t age = 0; age <= AgeHistogram::RECENT; age++)
+        {
+            if (age > 0)
+                value += ",";
+            value += std::to_string(ages.bucket(age));
+        }
+        value += " " + thread_name;
+
+        Renderer::get().metadata("leak_suspect", value);
     }
 };
 
@@ -84,39 +252,227 @@ struct MemoryTableEntry
 {
     FrameStack::Key stack;
     size_t size;
+    uint32_t epoch;  // Of the allocation
+    float weight;    // The number of allocations this one stands for
 };
 
 // ----------------------------------------------------------------------------
-class MemoryTable : public std::unordered_map<void*, MemoryTableEntry>
+// Table of the tracked allocations, keyed by address. This is updated from
+// within the allocator hooks of every allocating thread, so it must not
+// allocate through the hooked allocators, nor serialise all the threads on a
+// single lock. The table is thus split into stripes, each with its own lock
+// and its own open-addressing table with linear probing, whose slots are
+// allocated straight from anonymous mappings.
+class MemoryTable
 {
 public:
     // ------------------------------------------------------------------------
-    void link(void* address, FrameStack::Key stack, size_t size)
+    // Returns false if the allocation could not be tracked.
+    bool link(void* address, FrameStack::Key stack, size_t size, uint32_t epoch, float weight)
     {
-        std::lock_guard<std::mutex> lock(this->lock);
+        auto hash = hash_address(address);
+        auto& stripe = stripes[stripe_index(hash)];
+
+        std::lock_guard<std::mutex> lock(stripe.lock);
+
+        // Keep the load factor below 1/2, so that probe sequences stay short.
+        if ((stripe.count + 1) * 2 > stripe.capacity && !stripe.grow())
+            return false;  // Untracked, rather than failing the allocation
+
+        auto* slot = stripe.find(address, hash);
+        if (slot->address == nullptr)
+            stripe.count++;
+
+        *slot = {address, {stack, size, epoch, weight}};
 
-        this->emplace(address, MemoryTableEntry{stack, size});
+        return true;
     }
 
     // ------------------------------------------------------------------------
     std::optional<MemoryTableEntry> unlink(void* address)
     {
-        std::lock_guard<std::mutex> lock(this->lock);
+        auto hash = hash_address(address);
+        auto& stripe = stripes[stripe_index(hash)];
+
+        std::lock_guard<std::mutex> lock(stripe.lock);
+
+        if (stripe.count == 0)
+            return {};
+
+        auto* slot = stripe.find(address, hash);
+        if (slot->address == nullptr)
+            return {};
+
+        auto entry = slot->entry;
+        stripe.erase(slot);
+
+        return {entry};
+    }
+
+    // ------------------------------------------------------------------------
+    // Call the given function on each entry. Stripes are walked one at a
+    // time, so that only the threads allocating from the stripe being walked
+    // have to wait.
+    template <typename F>
+    void for_each(F on_entry)
+    {
+        for (auto& stripe : stripes)
+        {
+            std::lock_guard<std::mutex> lock(stripe.lock);
 
-        auto it = this->find(address);
+            for (size_t i = 0; i < stripe.capacity; i++)
+                if (stripe.slots[i].address != nullptr)
+                    on_entry(stripe.slots[i].entry);
+        }
+    }
 
-        if (it != this->end())
+    // ------------------------------------------------------------------------
+    size_t size()
+    {
+        size_t total = 0;
+
+        for (auto& stripe : stripes)
         {
-            auto entry = it->second;
-            erase(it);
-            return {entry};
+            std::lock_guard<std::mutex> lock(stripe.lock);
+
+            total += stripe.count;
         }
 
-        return {};
+        return total;
+    }
+
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        for (auto& stripe : stripes)
+        {
+            std::lock_guard<std::mutex> lock(stripe.lock);
+
+            stripe.release();
+        }
     }
 
 private:
-    std::mutex lock;
+    static constexpr size_t STRIPE_BITS = 6;
+    static constexpr size_t STRIPES = 1 << STRIPE_BITS;
+    static constexpr size_t INITIAL_CAPACITY = 1024;  // Slots, a power of two
+
+    struct Slot
+    {
+        void* address;  // nullptr for empty slots
+        MemoryTableEntry entry;
+    };
+
+    struct alignas(64) Stripe
+    {
+        Slot* slots = nullptr;
+        size_t capacity = 0;
+        size_t count = 0;
+        std::mutex lock;
+
+        // --------------------------------------------------------------------
+        // The slot holding the given address, or the empty slot where it
+        // would go. There is always at least one empty slot.
+        Slot* find(void* address, uint64_t hash)
+        {
+            auto mask = capacity - 1;
+            for (auto i = slot_index(hash, mask);; i = (i + 1) & mask)
+            {
+                auto* slot = &slots[i];
+                if (slot->address == address || slot->address == nullptr)
+                    return slot;
+            }
+        }
+
+        // --------------------------------------------------------------------
+        // Remove the entry in the given slot, and shift back the entries that
+        // follow it in the probe sequence, so that no tombstones are needed.
+        void erase(Slot* slot)
+        {
+            auto mask = capacity - 1;
+            auto hole = static_cast<size_t>(slot - slots);
+
+            for (auto i = (hole + 1) & mask; slots[i].address != nullptr; i = (i + 1) & mask)
+            {
+                auto home = slot_index(hash_address(slots[i].address), mask);
+
+                // Move the entry into the hole unless its home slot lies
+                // cyclically between the hole and its current slot.
+                if (((i - home) & mask) >= ((i - hole) & mask))
+                {
+                    slots[hole] = slots[i];
+                    hole = i;
+                }
+            }
+
+            slots[hole].address = nullptr;
+            count--;
+        }
+
+        // --------------------------------------------------------------------
+        bool grow()
+        {
+            auto new_capacity = capacity ? capacity * 2 : INITIAL_CAPACITY;
+            auto* new_slots = static_cast<Slot*>(mmap(nullptr, new_capacity * sizeof(Slot),
+                                                      PROT_READ | PROT_WRITE,
+                                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (new_slots == MAP_FAILED)
+                return false;
+
+            // Anonymous mappings are zero-filled, so all the slots are empty.
+            auto* old_slots = slots;
+            auto old_capacity = capacity;
+
+            slots = new_slots;
+            capacity = new_capacity;
+
+            for (size_t i = 0; i < old_capacity; i++)
+                if (old_slots[i].address != nullptr)
+                    *find(old_slots[i].address, hash_address(old_slots[i].address)) =
+                        old_slots[i];
+
+            if (old_slots != nullptr)
+                munmap(old_slots, old_capacity * sizeof(Slot));
+
+            return true;
+        }
+
+        // --------------------------------------------------------------------
+        void release()
+        {
+            if (slots != nullptr)
+                munmap(slots, capacity * sizeof(Slot));
+
+            slots = nullptr;
+            capacity = count = 0;
+        }
+    };
+
+    Stripe stripes[STRIPES];
+
+    // ------------------------------------------------------------------------
+    // Allocations are aligned, often to pages for large ones, so the low bits
+    // of addresses carry little information. The address is thus run through
+    // the splitmix64 finalizer, so that every bit of the hash depends on all
+    // the bits of the address. The stripe is picked with the high bits of the
+    // hash, and the slot with the low ones.
+    static inline uint64_t hash_address(void* address)
+    {
+        uint64_t x = reinterpret_cast<uintptr_t>(address);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    static inline size_t stripe_index(uint64_t hash)
+    {
+        return hash >> (64 - STRIPE_BITS);
+    }
+
+    static inline size_t slot_index(uint64_t hash, size_t mask)
+    {
+        return hash & mask;
+    }
 };
 
 // ----------------------------------------------------------------------------
@@ -124,7 +480,7 @@ class StackStats
 {
 public:
     // ------------------------------------------------------------------------
-    void inline update(PyThreadState* tstate, FrameStack::Key stack, size_t size)
+    void inline update(PyThreadState* tstate, FrameStack::Key stack, size_t size, uint32_t epoch)
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
@@ -140,26 +496,64 @@ public:
 
             // Map the memory address with the stack so that we can account for
             // the deallocations.
-            map.emplace(stack,
-                        MemoryStats(tstate->interp->id, thread_info_map[tstate->thread_id]->name,
-                                    stack, 1, size));
+            stack_entry =
+                map.emplace(stack, MemoryStats(tstate->interp->id,
+                                               thread_info_map[tstate->thread_id]->name, stack,
+                                               1, size))
+                    .first;
         }
         else
         {
             stack_entry->second.count++;
             stack_entry->second.size += size;
         }
+
+        if (leak_epochs > 0)
+            stack_entry->second.ages.add(epoch, size);
+    }
+
+    // ------------------------------------------------------------------------
+    // Account for an allocation (positive size), made by the given thread, or
+    // a deallocation (negative size). Events are drained from many threads,
+    // so a deallocation might be seen before the allocation it undoes, in
+    // which case the stack is named when the allocation comes in.
+    void inline update(int64_t iid, const std::string* thread_name, FrameStack::Key stack,
+                       int64_t size, uint32_t epoch)
+    {
+        std::lock_guard<std::mutex> lock(this->lock);
+
+        auto stack_entry = map.find(stack);
+
+        if (stack_entry == map.end())
+            stack_entry =
+                map.emplace(stack, MemoryStats(iid, thread_name != nullptr ? *thread_name : "",
+                                               stack, 0, 0))
+                    .first;
+        else if (thread_name != nullptr && stack_entry->second.thread_name.empty())
+        {
+            stack_entry->second.iid = iid;
+            stack_entry->second.thread_name = *thread_name;
+        }
+
+        if (size > 0)
+            stack_entry->second.count++;
+        stack_entry->second.size += size;
+        if (leak_epochs > 0)
+            stack_entry->second.ages.add(epoch, size);
     }
 
     // ------------------------------------------------------------------------
-    void inline update(MemoryTableEntry& entry)
+    // The interpreter and the name of the thread that made the allocations
+    // from the given stack.
+    std::pair<int64_t, std::string> thread(FrameStack::Key stack)
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
-        auto stack_entry = map.find(entry.stack);
+        auto stack_entry = map.find(stack);
+        if (stack_entry == map.end())
+            return {0, ""};
 
-        if (stack_entry != map.end())
-            stack_entry->second.size -= entry.size;
+        return {stack_entry->second.iid, stack_entry->second.thread_name};
     }
 
     // ------------------------------------------------------------------------
@@ -177,6 +571,13 @@ public:
             entry.second.size = 0;
             entry.second.count = 0;
         }
+
+        if (leak_epochs > 0)
+            for (auto& entry : map)
+                entry.second.check_leak(leak_epochs);
+
+        // Allocations made from now on belong to the next epoch.
+        memory_epoch.fetch_add(1, std::memory_order_relaxed);
     }
 
     // ------------------------------------------------------------------------
@@ -200,10 +601,298 @@ private:
 inline auto& stack_stats = *(new StackStats());
 inline auto& memory_table = *(new MemoryTable());
 
+// ----------------------------------------------------------------------------
+// Allocating threads do not update the stack stats themselves, as they would
+// all contend on them. Each thread appends its allocation and deallocation
+// events to its own ring buffer instead, which the sampler thread drains into
+// the stack stats. A thread whose buffer is full updates the stack stats
+// itself, so that no events are lost.
+class AllocationEvents
+{
+public:
+    // ------------------------------------------------------------------------
+    // Append an event to the buffer of the calling thread. The thread state
+    // is that of the allocating thread, if known.
+    bool inline push(FrameStack::Key stack, int64_t size, uint32_t epoch, PyThreadState* tstate)
+    {
+        auto* buffer = local_buffer();
+        if (buffer == nullptr)
+            return false;
+
+        auto head = buffer->head.load(std::memory_order_relaxed);
+        if (head - buffer->tail.load(std::memory_order_acquire) == CAPACITY)
+            return false;
+
+        if (tstate != nullptr && !buffer->named.load(std::memory_order_relaxed))
+            name(*buffer, tstate, head);
+
+        buffer->events[head & (CAPACITY - 1)] = {stack, size, epoch};
+        buffer->head.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    // Account for all the events in the buffers, and release the buffers of
+    // the threads that have exited. Called by the sampler thread, and before
+    // heap snapshots. The list of buffers is only locked to take it, and to
+    // put back what is left of it, so that new threads do not wait on the
+    // stack stats to register their buffers.
+    void drain()
+    {
+        std::lock_guard<std::mutex> drain_guard(drain_lock);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            draining.swap(buffers);
+        }
+
+        for (auto it = draining.begin(); it != draining.end();)
+        {
+            auto* buffer = *it;
+
+            // A thread that is done pushes no more events after these.
+            auto done = buffer->done.load(std::memory_order_acquire);
+            auto head = buffer->head.load(std::memory_order_acquire);
+            auto tail = buffer->tail.load(std::memory_order_relaxed);
+
+            if (tail != head)
+            {
+                // Threads that were never seen with a name are looked up now.
+                std::string looked_up_name;
+                auto named = buffer->named.load(std::memory_order_acquire);
+                if (!named)
+                    looked_up_name =
+                        lookup_thread_name(buffer->thread_id.load(std::memory_order_relaxed));
+                auto& thread_name = named ? buffer->thread_name : looked_up_name;
+                auto iid = buffer->iid.load(std::memory_order_relaxed);
+
+                for (; tail != head; tail++)
+                {
+                    auto& event = buffer->events[tail & (CAPACITY - 1)];
+                    stack_stats.update(iid, event.size > 0 ? &thread_name : nullptr, event.stack,
+                                       event.size, event.epoch);
+                }
+
+                buffer->tail.store(tail, std::memory_order_release);
+            }
+
+            if (done)
+            {
+                buffer->~Buffer();
+                munmap(buffer, sizeof(Buffer));
+                it = draining.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        buffers.insert(buffers.end(), draining.begin(), draining.end());
+        draining.clear();
+    }
+
+private:
+    static constexpr size_t CAPACITY = 1 << 12;  // Events, a power of two
+
+    struct Event
+    {
+        FrameStack::Key stack;
+        int64_t size;    // Negative for deallocations
+        uint32_t epoch;  // Of the allocation
+    };
+
+    struct Buffer
+    {
+        Event events[CAPACITY];
+
+        alignas(64) std::atomic<size_t> head;  // Written by the owner
+        alignas(64) std::atomic<size_t> tail;  // Written by the sampler
+
+        std::atomic<uintptr_t> thread_id;
+        std::atomic<int64_t> iid;
+        std::string thread_name;  // Set by the owner, before named
+        std::atomic<bool> named;
+        std::atomic<bool> done;  // The owner has exited
+    };
+
+    // Marks the buffer of the thread as done when the thread exits. Threads
+    // can still allocate after that, while tearing down, and update the stack
+    // stats themselves then.
+    struct Handle
+    {
+        Buffer* buffer = nullptr;
+
+        ~Handle()
+        {
+            if (buffer != nullptr)
+                buffer->done.store(true, std::memory_order_release);
+
+            buffer = nullptr;
+            exited = true;
+        }
+    };
+
+    static inline thread_local bool exited = false;
+
+    std::vector<Buffer*> buffers;
+    std::mutex lock;
+
+    std::vector<Buffer*> draining;  // The buffers being drained
+    std::mutex drain_lock;
+
+    // ------------------------------------------------------------------------
+    // Buffers are allocated straight from anonymous mappings, which are
+    // zero-filled, rather than through the hooked allocators.
+    Buffer* local_buffer()
+    {
+        static thread_local Handle handle;
+
+        if (handle.buffer != nullptr)
+            return handle.buffer;
+
+        if (exited)
+            return nullptr;
+
+        auto* memory = mmap(nullptr, sizeof(Buffer), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return nullptr;
+
+        auto* buffer = new (memory) Buffer();
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        buffers.push_back(buffer);
+        handle.buffer = buffer;
+
+        return buffer;
+    }
+
+    // ------------------------------------------------------------------------
+    // The thread is named when its buffer gets its first events, as it might
+    // be gone from the thread info map by the time the sampler drains them.
+    // Threads are tracked once they start running, so this is retried on the
+    // first events until the thread is found, and left to the sampler after
+    // that.
+    static void name(Buffer& buffer, PyThreadState* tstate, size_t head)
+    {
+        static constexpr size_t NAME_ATTEMPTS = 1 << 10;  // Events
+
+        if (head >= NAME_ATTEMPTS)
+            return;
+
+        buffer.iid.store(tstate->interp->id, std::memory_order_relaxed);
+        buffer.thread_id.store(tstate->thread_id, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> guard(thread_info_map_lock);
+
+        auto entry = thread_info_map.find(tstate->thread_id);
+        if (entry == thread_info_map.end())
+            return;
+
+        buffer.thread_name = entry->second->name;
+        buffer.named.store(true, std::memory_order_release);
+    }
+
+    // ------------------------------------------------------------------------
+    static std::string lookup_thread_name(uintptr_t thread_id)
+    {
+        std::lock_guard<std::mutex> guard(thread_info_map_lock);
+
+        auto entry = thread_info_map.find(thread_id);
+        return entry != thread_info_map.end() ? entry->second->name : std::string();
+    }
+};
+
+inline auto& allocation_events = *(new AllocationEvents());
+
+// ----------------------------------------------------------------------------
+// Byte sampling of allocations, as in tcmalloc. Each thread counts down the
+// bytes it allocates from a threshold drawn from an exponential distribution
+// with the sampling rate as its mean, and the allocation that crosses it is
+// sampled. An allocation of a given size is then sampled with probability
+// 1 - exp(-size / rate), so its size is scaled by the inverse of that to give
+// an unbiased estimate of the memory allocated from each stack.
+class AllocationSampler
+{
+public:
+    // ------------------------------------------------------------------------
+    // The estimated size of the allocation if it is sampled, 0 otherwise.
+    inline size_t sample(size_t size)
+    {
+        remaining -= static_cast<int64_t>(size);
+        if (remaining > 0)
+            return 0;
+
+        return sample_slow(size);
+    }
+
+private:
+    int64_t remaining = 0;
+    uint64_t state = 0;
+
+    // ------------------------------------------------------------------------
+    size_t sample_slow(size_t size)
+    {
+        auto rate = static_cast<double>(memory_sample_rate);
+
+        if (state == 0)
+        {
+            // First allocation of the thread: seed the generator and start
+            // counting, rather than sampling it.
+            auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+            state = (reinterpret_cast<uintptr_t>(this) ^ static_cast<uint64_t>(now)) | 1;
+            remaining += threshold(rate);
+            if (remaining > 0)
+                return 0;
+        }
+
+        remaining = threshold(rate);
+
+        if (size == 0)
+            return 0;
+
+        return static_cast<size_t>(size / -std::expm1(-static_cast<double>(size) / rate));
+    }
+
+    // ------------------------------------------------------------------------
+    int64_t threshold(double rate)
+    {
+        // xorshift64*, with 53 bits to a uniform value in (0, 1]
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        auto u = static_cast<double>(((state * 0x2545f4914f6cdd1dULL) >> 11) + 1) * 0x1p-53;
+
+        return static_cast<int64_t>(-std::log(u) * rate) + 1;
+    }
+};
+
 // ----------------------------------------------------------------------------
 static inline void general_alloc(void* address, size_t size)
 {
-    auto stack = std::make_unique<FrameStack>();
+    float weight = 1;
+
+    if (memory_sample_rate > 0)
+    {
+        static thread_local AllocationSampler sampler;
+
+        auto estimated = sampler.sample(size);
+        if (estimated == 0)
+            return;
+
+        weight = static_cast<float>(estimated) / static_cast<float>(size);
+        size = estimated;
+    }
+
+    // Allocations are frequent, so we unwind into a per-thread buffer that we
+    // reuse across calls.
+    static thread_local FrameStack stack(max_frames);
     auto* tstate = PyThreadState_Get();  // DEV: This should be called with the GIL held
 
     // DEV: We unwind the stack by reading the data out of live Python objects.
@@ -212,17 +901,21 @@ static inline void general_alloc(void* address, size_t size)
     // Therefore, we expect these structures to remain valid and essentially
     // immutable for the duration of the unwinding process, which happens
     // in-line with the allocation within the calling thread.
-    unwind_python_stack_unsafe(tstate, *stack);
+    unwind_python_stack_unsafe(tstate, stack);
 
     // Store the stack and get its key for reference
     // TODO: Handle collision exception
-    auto stack_key = stack_table.store(std::move(stack));
+    auto stack_key = stack_table.store(stack);
 
-    // Link the memory address with the stack
-    memory_table.link(address, stack_key, size);
+    // Link the memory address with the stack. The stats only account for
+    // tracked allocations, as the others would never be freed.
+    auto epoch = memory_epoch.load(std::memory_order_relaxed);
+    if (!memory_table.link(address, stack_key, size, epoch, weight))
+        return;
 
-    // Update the stack stats
-    stack_stats.update(tstate, stack_key, size);
+    // Update the stack stats, or have the sampler do it
+    if (!allocation_events.push(stack_key, static_cast<int64_t>(size), epoch, tstate))
+        stack_stats.update(tstate, stack_key, size, epoch);
 }
 
 // ----------------------------------------------------------------------------
@@ -230,20 +923,99 @@ static inline void general_free(void* address)
 {
     // Retrieve the stack that made the allocation
     if (auto entry = memory_table.unlink(address))
-        // Update the stack stats
-        stack_stats.update(*entry);
+    {
+        // Update the stack stats, or have the sampler do it
+        auto size = -static_cast<int64_t>(entry->size);
+        if (!allocation_events.push(entry->stack, size, entry->epoch, nullptr))
+            stack_stats.update(0, nullptr, entry->stack, size, entry->epoch);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Write the memory that is currently allocated, i.e. the bytes and the number
+// of objects that are still live, by allocation stack. With allocation
+// sampling, these are estimates, as for the memory samples. Returns the path
+// of the snapshot.
+static Result<std::string> heap_snapshot(const char* path)
+{
+    if (!memory)
+        return ErrorKind::RendererError;
+
+    // Make sure that the stack stats know about all the stacks.
+    allocation_events.drain();
+
+    struct Live
+    {
+        uint64_t size = 0;
+        double count = 0;
+    };
+    std::unordered_map<FrameStack::Key, Live> live;
+
+    memory_table.for_each([&](const MemoryTableEntry& entry) {
+        auto& stack_live = live[entry.stack];
+        stack_live.size += entry.size;
+        stack_live.count += entry.weight;
+    });
+
+    return Renderer::get().heap_snapshot(path, [&](auto emit) {
+        for (auto& [stack, stack_live] : live)
+        {
+            auto [iid, thread_name] = stack_stats.thread(stack);
+
+            SampleView sample;
+            sample.pid = pid;
+            sample.iid = iid;
+            sample.thread_name = &thread_name;
+            sample.metric_type = MetricType::Memory;
+            sample.delta = stack_live.size;
+            sample.count = static_cast<uint64_t>(std::llround(stack_live.count));
+
+            stack_table.view(stack, sample);
+
+            emit(sample);
+        }
+    });
 }
 
+// ----------------------------------------------------------------------------
+// The allocators of a domain can call those of another one, e.g. pymalloc
+// hands large blocks over to the raw allocator, so that the same block goes
+// through the hooks twice. Only the outermost call is tracked.
+class AllocatorGuard
+{
+public:
+    AllocatorGuard() : outermost(!active)
+    {
+        active = true;
+    }
+
+    ~AllocatorGuard()
+    {
+        if (outermost)
+            active = false;
+    }
+
+    explicit operator bool() const
+    {
+        return outermost;
+    }
+
+private:
+    static inline thread_local bool active = false;
+    bool outermost;
+};
+
 // ----------------------------------------------------------------------------
 static void* echion_malloc(void* ctx, size_t n)
 {
     auto* alloc = static_cast<PyMemAllocatorEx*>(ctx);
+    AllocatorGuard guard;
 
     // Make the actual allocation
     auto address = alloc->malloc(alloc->ctx, n);
 
     // Handle the allocation event
-    if (address != NULL)
+    if (address != NULL && guard)
         general_alloc(address, n);
 
     return address;
@@ -253,12 +1025,13 @@ static void* echion_malloc(void* ctx, size_t n)
 static void* echion_calloc(void* ctx, size_t nelem, size_t elsize)
 {
     auto* alloc = static_cast<PyMemAllocatorEx*>(ctx);
+    AllocatorGuard guard;
 
     // Make the actual allocation
     auto address = alloc->calloc(alloc->ctx, nelem, elsize);
 
     // Handle the allocation event
-    if (address != NULL)
+    if (address != NULL && guard)
         general_alloc(address, nelem * elsize);
 
     return address;
@@ -268,14 +1041,15 @@ static void* echion_calloc(void* ctx, size_t nelem, size_t elsize)
 static void* echion_realloc(void* ctx, void* p, size_t n)
 {
     auto* alloc = static_cast<PyMemAllocatorEx*>(ctx);
+    AllocatorGuard guard;
 
     // Model this as a deallocation followed by an allocation
-    if (p != NULL)
+    if (p != NULL && guard)
         general_free(p);
 
     auto address = alloc->realloc(alloc->ctx, p, n);
 
-    if (address != NULL)
+    if (address != NULL && guard)
         general_alloc(address, n);
 
     return address;
@@ -285,9 +1059,10 @@ static void* echion_realloc(void* ctx, void* p, size_t n)
 static void echion_free(void* ctx, void* p)
 {
     auto* alloc = static_cast<PyMemAllocatorEx*>(ctx);
+    AllocatorGuard guard;
 
     // Handle the deallocation event
-    if (p != NULL)
+    if (p != NULL && guard)
         general_free(p);
 
     alloc->free(alloc->ctx, p);
@@ -324,6 +1099,7 @@ static void teardown_memory()
     for (int i = 0; i < ALLOC_DOMAIN_COUNT; i++)
         PyMem_SetAllocator(static_cast<PyMemAllocatorDomain>(i), &original_allocators[i]);
 
+    allocation_events.drain();
     stack_stats.flush();
 
     stack_stats.clear();
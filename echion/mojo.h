@@ -4,8 +4,23 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #define MOJO_VERSION 3
 
+// Version 4 adds stack interning: each unique stack is defined once with a
+// MOJO_STACK_DEF event (key, number of frames, frame keys from the root to the
+// leaf) and then referenced by samples with a MOJO_STACK_REF event (key), in
+// place of the frame references. A sample can also end with a
+// MOJO_SAMPLE_COUNT event (count) after its metric, when it stands for that
+// many consecutive identical samples folded together.
+#define MOJO_VERSION_STACK_REFS 4
+
 enum MojoEvent
 {
     MOJO_RESERVED,
@@ -21,6 +36,9 @@ enum MojoEvent
     MOJO_METRIC_MEMORY,
     MOJO_STRING,
     MOJO_STRING_REF,
+    MOJO_STACK_DEF,
+    MOJO_STACK_REF,
+    MOJO_SAMPLE_COUNT,
     MOJO_MAX,
 };
 
@@ -33,3 +51,243 @@ using mojo_int_t = long long;
 using mojo_uint_t = unsigned long long;
 using mojo_ref_t = unsigned long long;
 #endif
+
+// ----------------------------------------------------------------------------
+// A growable byte buffer with the MOJO encoders. Events are encoded in memory
+// and written out in bulk, rather than byte by byte on the output stream.
+class MojoBuffer
+{
+public:
+    // ------------------------------------------------------------------------
+    inline const char* data() const
+    {
+        return bytes.get();
+    }
+
+    inline size_t size() const
+    {
+        return length;
+    }
+
+    inline bool empty() const
+    {
+        return length == 0;
+    }
+
+    inline void clear()
+    {
+        length = 0;
+    }
+
+    // ------------------------------------------------------------------------
+    inline void event(MojoEvent event)
+    {
+        reserve(1);
+        bytes[length++] = static_cast<char>(event);
+    }
+
+    // ------------------------------------------------------------------------
+    inline void string(const char* value, size_t size)
+    {
+        reserve(size + 1);
+        std::memcpy(bytes.get() + length, value, size);
+        length += size;
+        bytes[length++] = '\0';
+    }
+
+    inline void string(const std::string& value)
+    {
+        string(value.data(), value.size());
+    }
+
+    inline void string(const char* value)
+    {
+        string(value, std::strlen(value));
+    }
+
+    // ------------------------------------------------------------------------
+    inline void ref(mojo_ref_t value)
+    {
+        integer(value);
+    }
+
+    // ------------------------------------------------------------------------
+    // The first byte carries 6 bits of the value, the sign bit and the
+    // continuation bit; every following byte carries 7 bits and the
+    // continuation bit.
+    inline void integer(mojo_int_t n)
+    {
+        reserve(MAX_INTEGER_SIZE);
+
+        mojo_uint_t value = n < 0 ? -static_cast<mojo_uint_t>(n) : n;
+        char* p = bytes.get() + length;
+
+        unsigned char byte = value & 0x3f;
+        if (n < 0)
+            byte |= 0x40;
+        value >>= 6;
+
+        while (value)
+        {
+            *p++ = static_cast<char>(byte | 0x80);
+            byte = value & 0x7f;
+            value >>= 7;
+        }
+        *p++ = static_cast<char>(byte);
+
+        length = p - bytes.get();
+    }
+
+    // ------------------------------------------------------------------------
+    inline void raw(const char* value, size_t size)
+    {
+        reserve(size);
+        std::memcpy(bytes.get() + length, value, size);
+        length += size;
+    }
+
+private:
+    static constexpr size_t MAX_INTEGER_SIZE = 10;
+
+    std::unique_ptr<char[]> bytes = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+
+    // ------------------------------------------------------------------------
+    inline void reserve(size_t size)
+    {
+        if (capacity - length >= size)
+            return;
+
+        size_t new_capacity = capacity ? capacity : 4096;
+        while (new_capacity - length < size)
+            new_capacity <<= 1;
+
+        auto new_bytes = std::make_unique<char[]>(new_capacity);
+        if (length)
+            std::memcpy(new_bytes.get(), bytes.get(), length);
+
+        bytes = std::move(new_bytes);
+        capacity = new_capacity;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// The header, metadata and definitions that make an output readable on its
+// own, e.g. the start of every rotated file. Each definition is kept once per
+// key, so that those emitted again, e.g. for frames evicted from the cache
+// and seen again, replace the previous ones rather than pile up. Other events
+// are kept once per content.
+class MojoPreamble
+{
+public:
+    // ------------------------------------------------------------------------
+    // Add a single encoded event.
+    void add(const char* data, size_t size)
+    {
+        std::string record(data, size);
+        auto id = identity(record);
+
+        auto known = positions.find(id);
+        if (known != positions.end())
+        {
+            if (records[known->second] == record)
+                return;
+
+            // Redefined: the new definition goes at the end, after anything
+            // it might refer to.
+            bytes -= records[known->second].size();
+            records[known->second].clear();
+            superseded++;
+        }
+
+        bytes += record.size();
+        positions[id] = records.size();
+        records.push_back(std::move(record));
+        changed = true;
+
+        if (superseded > records.size() / 2)
+            compact();
+    }
+
+    // ------------------------------------------------------------------------
+    // The whole preamble, as a single buffer.
+    const MojoBuffer& buffer()
+    {
+        if (changed)
+        {
+            encoded.clear();
+            for (auto& record : records)
+                encoded.raw(record.data(), record.size());
+            changed = false;
+        }
+
+        return encoded;
+    }
+
+    // ------------------------------------------------------------------------
+    size_t size() const
+    {
+        return bytes;
+    }
+
+    bool empty() const
+    {
+        return bytes == 0;
+    }
+
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        records.clear();
+        positions.clear();
+        encoded.clear();
+        bytes = 0;
+        superseded = 0;
+        changed = false;
+    }
+
+private:
+    std::vector<std::string> records;  // Empty once superseded
+    std::unordered_map<std::string, size_t> positions;
+    MojoBuffer encoded;
+    size_t bytes = 0;
+    size_t superseded = 0;
+    bool changed = false;
+
+    // ------------------------------------------------------------------------
+    // Definitions are identified by their event and key, i.e. the encoded
+    // reference that follows the event, and anything else by its content.
+    static std::string identity(const std::string& record)
+    {
+        auto event = static_cast<unsigned char>(record[0]);
+        if (event != MOJO_FRAME && event != MOJO_STRING && event != MOJO_STACK_DEF)
+            return record;
+
+        size_t end = 1;
+        while (end < record.size() && (record[end] & 0x80))
+            end++;
+
+        return record.substr(0, end + 1);
+    }
+
+    // ------------------------------------------------------------------------
+    void compact()
+    {
+        std::vector<std::string> live;
+        live.reserve(records.size() - superseded);
+
+        positions.clear();
+        for (auto& record : records)
+        {
+            if (record.empty())
+                continue;
+
+            positions[identity(record)] = live.size();
+            live.push_back(std::move(record));
+        }
+
+        records = std::move(live);
+        superseded = 0;
+    }
+};
@@ -0,0 +1,119 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// A minimal protocol buffers encoder, with just what is needed to write
+// messages field by field. Zero-valued scalars are skipped, as in proto3.
+class ProtoBuffer
+{
+public:
+    enum WireType
+    {
+        VARINT = 0,
+        LENGTH_DELIMITED = 2,
+    };
+
+    // ------------------------------------------------------------------------
+    inline const std::string& data() const
+    {
+        return buffer;
+    }
+
+    inline size_t size() const
+    {
+        return buffer.size();
+    }
+
+    inline void clear()
+    {
+        buffer.clear();
+    }
+
+    // ------------------------------------------------------------------------
+    inline void uint64(int field, uint64_t value)
+    {
+        if (value == 0)
+            return;
+
+        tag(field, VARINT);
+        varint(value);
+    }
+
+    // ------------------------------------------------------------------------
+    inline void int64(int field, int64_t value)
+    {
+        uint64(field, static_cast<uint64_t>(value));
+    }
+
+    // ------------------------------------------------------------------------
+    // Strings are always written, as the empty string is significant in
+    // repeated fields.
+    inline void string(int field, const std::string& value)
+    {
+        tag(field, LENGTH_DELIMITED);
+        varint(value.size());
+        buffer.append(value);
+    }
+
+    // ------------------------------------------------------------------------
+    inline void message(int field, const ProtoBuffer& value)
+    {
+        string(field, value.buffer);
+    }
+
+    // ------------------------------------------------------------------------
+    template <typename T>
+    inline void packed(int field, const std::vector<T>& values)
+    {
+        if (values.empty())
+            return;
+
+        size_t size = 0;
+        for (auto value : values)
+            size += varint_size(static_cast<uint64_t>(value));
+
+        tag(field, LENGTH_DELIMITED);
+        varint(size);
+        for (auto value : values)
+            varint(static_cast<uint64_t>(value));
+    }
+
+private:
+    std::string buffer;
+
+    // ------------------------------------------------------------------------
+    inline void tag(int field, WireType type)
+    {
+        varint((static_cast<uint64_t>(field) << 3) | type);
+    }
+
+    // ------------------------------------------------------------------------
+    inline void varint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back(static_cast<char>(value));
+    }
+
+    // ------------------------------------------------------------------------
+    static inline size_t varint_size(uint64_t value)
+    {
+        size_t size = 1;
+        while (value >= 0x80)
+        {
+            value >>= 7;
+            size++;
+        }
+        return size;
+    }
+};
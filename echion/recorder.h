@@ -0,0 +1,156 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
+
+#include <echion/config.h>
+#include <echion/errors.h>
+#include <echion/mojo.h>
+#include <echion/sink.h>
+
+// ----------------------------------------------------------------------------
+// Flight recorder. Nothing is written out: samples are kept in a ring of
+// chunks of fixed total size, overwriting the oldest ones, until a snapshot
+// is requested. A chunk is also moved on from when it covers a slice of the
+// recording window, so that snapshots do not go too far back in time when
+// samples come in slowly. The snapshot is made of the preamble, which holds all
+// the definitions, followed by the chunks that were written to within the
+// recording window, so it can be read on its own.
+class FlightRecorder : public OutputSink
+{
+public:
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Result<void> open(const char*) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        auto count = flight_recorder_size / CHUNK_SIZE;
+        chunks.resize(count < 2 ? 2 : count);
+        for (auto& chunk : chunks)
+            chunk.buffer.clear();
+        current = 0;
+        slice = std::chrono::milliseconds(flight_recorder * 1000) /
+                std::min<size_t>(SLICES, chunks.size() - 1);
+        owner = getpid();
+        active = true;
+
+        return Result<void>::ok();
+    }
+
+    // ------------------------------------------------------------------------
+    void close() override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        active = false;
+        chunks.clear();
+    }
+
+    // ------------------------------------------------------------------------
+    // Definitions are in the preamble, and anything else is not needed to
+    // decode the samples.
+    bool write(const char* data, size_t size, RecordKind kind, std::string_view) override
+    {
+        if (kind != RECORD_SAMPLE && kind != RECORD_SAMPLES)
+            return true;
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (!active)
+            return false;
+
+        auto now = std::chrono::steady_clock::now();
+        auto* chunk = &chunks[current];
+        if (!chunk->buffer.empty() &&
+            (chunk->buffer.size() + size > CHUNK_SIZE || now - chunk->first >= slice))
+        {
+            current = (current + 1) % chunks.size();
+            chunk = &chunks[current];
+            chunk->buffer.clear();
+        }
+
+        if (chunk->buffer.empty())
+            chunk->first = now;
+        chunk->buffer.raw(data, size);
+        chunk->last = now;
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool needs_preamble() const override
+    {
+        return true;
+    }
+
+    bool restart_due() override
+    {
+        return false;
+    }
+
+    void restart(const MojoBuffer&) override {}
+
+    // ------------------------------------------------------------------------
+    // Samples are overwritten by design, rather than dropped.
+    size_t dropped_records() override
+    {
+        return 0;
+    }
+
+    // ------------------------------------------------------------------------
+    bool forked() const override
+    {
+        return owner != 0 && owner != getpid();
+    }
+
+    // ------------------------------------------------------------------------
+    // The window is applied to whole chunks, so the snapshot might go back
+    // a slice further in time.
+    [[nodiscard]] Result<void> snapshot(const MojoBuffer& preamble, MojoBuffer& output) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (!active)
+            return ErrorKind::RendererError;
+
+        auto since = std::chrono::steady_clock::now() - std::chrono::seconds(flight_recorder);
+
+        output.raw(preamble.data(), preamble.size());
+
+        for (size_t i = 1; i <= chunks.size(); i++)
+        {
+            auto& chunk = chunks[(current + i) % chunks.size()];
+            if (!chunk.buffer.empty() && chunk.last >= since)
+                output.raw(chunk.buffer.data(), chunk.buffer.size());
+        }
+
+        return Result<void>::ok();
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 256 << 10;
+    static constexpr size_t SLICES = 16;  // Of the recording window
+
+    struct Chunk
+    {
+        MojoBuffer buffer;
+        std::chrono::steady_clock::time_point first;  // First write
+        std::chrono::steady_clock::time_point last;   // Last write
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current = 0;  // The chunk being written to
+    std::chrono::steady_clock::duration slice;
+    bool active = false;
+    pid_t owner = 0;
+
+    std::mutex lock;
+};
@@ -0,0 +1,59 @@
+# This file is part of "echion" which is released under MIT.
+#
+# Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+"""Recover the MOJO stream from a crash-durable output file (-o mmap:PATH).
+
+The layout of the file is documented in echion/mapped.h. Everything up to the
+committed length is made of complete records, so anything past it, e.g. a
+sample that was being copied when the process was killed, is ignored.
+"""
+
+import struct
+import sys
+import typing as t
+
+MAGIC = b"ECHOMMAP"
+HEADER = "=8sIIQI"
+
+STATE_CLOSED = 2
+
+
+def recover(path: str) -> t.Tuple[bytes, bool]:
+    """Return the committed MOJO stream, and whether the output was closed."""
+    with open(path, "rb") as f:
+        header = f.read(struct.calcsize(HEADER))
+        if len(header) < struct.calcsize(HEADER):
+            raise ValueError(f"{path} is not an echion durable output")
+
+        magic, version, data_offset, committed, state = struct.unpack(HEADER, header)
+        if magic != MAGIC or version != 1:
+            raise ValueError(f"{path} is not an echion durable output")
+
+        f.seek(data_offset)
+        data = f.read(committed)
+
+    if len(data) < committed:
+        raise ValueError(f"{path} is shorter than its committed length")
+
+    return data, state == STATE_CLOSED
+
+
+def main() -> None:
+    try:
+        path, output = sys.argv[1:]
+    except ValueError:
+        print("usage: python -m echion.recover FILE OUTPUT", file=sys.stderr)
+        sys.exit(1)
+
+    data, closed = recover(path)
+
+    with open(output, "wb") as f:
+        f.write(data)
+
+    if not closed:
+        print(f"{path} was not closed: recovered {len(data)} bytes", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
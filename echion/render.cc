@@ -42,3 +42,9 @@ void MojoRenderer::render_frame(Frame& frame)
 {
     frame_ref(frame.cache_key);
 }
+
+// ------------------------------------------------------------------------
+void ResolvingRenderer::render_frame(Frame& frame)
+{
+    frame_ref(frame.cache_key);
+}
@@ -4,17 +4,35 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <ostream>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include <echion/aggregator.h>
 #include <echion/config.h>
 #include <echion/errors.h>
+#include <echion/gzip.h>
+#include <echion/mapped.h>
 #include <echion/mojo.h>
+#include <echion/protobuf.h>
+#include <echion/recorder.h>
+#include <echion/shm.h>
+#include <echion/socket.h>
 #include <echion/timing.h>
+#include <echion/writer.h>
 
 #include <Python.h>
 
@@ -27,6 +45,33 @@ enum MetricType
     Memory
 };
 
+// ----------------------------------------------------------------------------
+// Everything there is to know about a sample, so that it can be handed to a
+// renderer with a single call.
+struct SampleView
+{
+    long long pid = 0;
+    long long iid = 0;
+    const std::string* thread_name = nullptr;
+
+    // For asyncio tasks and greenlets only
+    const std::string* task_name = nullptr;
+    bool on_cpu = false;
+
+    // Either the keys of the frames, from the leaf to the root, or the key of
+    // the interned stack, when stacks are interned.
+    const mojo_ref_t* frames = nullptr;
+    size_t frame_count = 0;
+    mojo_ref_t stack_key = 0;
+
+    MetricType metric_type = MetricType::Time;
+    uint64_t cpu_time = 0;  // In CPU mode only
+    uint64_t delta = 0;
+
+    // Number of samples, or of objects in heap snapshots, this stands for
+    uint64_t count = 1;
+};
+
 class RendererInterface
 {
 public:
@@ -51,6 +96,14 @@ public:
     // Refers to the string stored using the renderer's string function
     virtual void string_ref(mojo_ref_t key) = 0;
 
+    // If a renderer has its own caching mechanism for stacks, this can be used
+    // to store an interned stack. The frame keys are given from the leaf to
+    // the root.
+    virtual void stack_def(mojo_ref_t key, const mojo_ref_t* frames, size_t count) = 0;
+
+    // Refers to the stack stored using the renderer's stack_def function
+    virtual void stack_ref(mojo_ref_t key) = 0;
+
     // Called to render a message from the profiler.
     virtual void render_message(std::string_view msg) = 0;
 
@@ -72,6 +125,35 @@ public:
     virtual void render_cpu_time(uint64_t cpu_time) = 0;
     virtual void render_stack_end(MetricType metric_type, uint64_t delta) = 0;
 
+    // Called before render_stack_end when the sample stands for more than one,
+    // e.g. a run of folded samples.
+    virtual void render_sample_count(uint64_t) {}
+
+    // Called once for each sample, in place of all the calls above, from
+    // render_task_begin to render_stack_end. Renderers can override this to
+    // take in the whole sample at once.
+    virtual void render_sample(const SampleView& sample)
+    {
+        if (sample.task_name != nullptr)
+            render_task_begin(*sample.task_name, sample.on_cpu);
+
+        render_stack_begin(sample.pid, sample.iid, *sample.thread_name);
+
+        if (sample.stack_key != 0)
+            stack_ref(sample.stack_key);
+        else
+            for (auto i = sample.frame_count; i > 0; i--)
+                frame_ref(sample.frames[i - 1]);
+
+        if (cpu && sample.metric_type == MetricType::Time)
+            render_cpu_time(sample.cpu_time);
+
+        if (sample.count > 1)
+            render_sample_count(sample.count);
+
+        render_stack_end(sample.metric_type, sample.delta);
+    }
+
     // The validity of the interface is a two-step process
     // 1. If the RendererInterface has been destroyed, obviously it's invalid
     // 2. There might be state behind RendererInterface, and the lifetime of that
@@ -133,6 +215,8 @@ public:
     void frame_kernel(const std::string&) override {};
     void string(mojo_ref_t, const std::string&) override {};
     void string_ref(mojo_ref_t) override{};
+    void stack_def(mojo_ref_t, const mojo_ref_t*, size_t) override {};
+    void stack_ref(mojo_ref_t) override{};
 
     void render_thread_begin(PyThreadState*, std::string_view name, microsecond_t, uintptr_t,
                              unsigned long) override
@@ -155,51 +239,270 @@ public:
     }
 };
 
+// ----------------------------------------------------------------------------
+static inline OutputSink* make_sink(const char* output)
+{
+    if (flight_recorder > 0)
+        return new FlightRecorder();
+
+    if (output != nullptr &&
+        std::strncmp(output, ShmRingWriter::SCHEME, std::strlen(ShmRingWriter::SCHEME)) == 0)
+        return new ShmRingWriter();
+
+    if (output != nullptr &&
+        std::strncmp(output, UnixSocketSink::SCHEME, std::strlen(UnixSocketSink::SCHEME)) == 0)
+        return new UnixSocketSink();
+
+    if (output != nullptr &&
+        std::strncmp(output, MappedFileWriter::SCHEME, std::strlen(MappedFileWriter::SCHEME)) == 0)
+        return new MappedFileWriter();
+
+    return new OutputWriter();
+}
+
 class MojoRenderer : public RendererInterface
 {
-    std::ofstream output;
-    std::mutex lock;
+    // A new writer is made for every session, according to the output.
+    OutputSink* writer = new OutputWriter();
     uint64_t metric = 0;
 
-    void inline event(MojoEvent event)
+    // The header, metadata and the definitions written so far. When the
+    // output is restarted, e.g. rotated, this is written at the start of the
+    // new output so that it can be read on its own.
+    MojoPreamble preamble;
+    std::mutex preamble_lock;
+
+    // Events are encoded into thread-local buffers and handed to the writer
+    // with a single append. Samples are accumulated from the stack
+    // event to the metric event and committed as a whole, while any other
+    // event is committed straight away. Definitions emitted while a sample
+    // is being built are therefore written before the sample that uses them.
+    static inline thread_local MojoBuffer sample_buffer;
+    static inline thread_local MojoBuffer event_buffer;
+    static inline thread_local bool in_sample = false;
+    static inline thread_local std::string sample_thread;
+
+    // Time samples are folded here in aggregation mode, and written out
+    // periodically with their summed metric.
+    SampleAggregator aggregator;
+
+    // In folding mode, the current run of identical samples of each thread,
+    // and task, which is written out as a single sample when the stack
+    // changes, or when the run gets too long.
+    struct Run
+    {
+        MojoBuffer sample;  // Encoded up to the metric
+        std::string thread_name;
+        mojo_ref_t stack_key = 0;
+        std::vector<mojo_ref_t> frames;
+        uint64_t metric = 0;
+        uint64_t count = 0;
+        microsecond_t start = 0;
+    };
+
+    std::unordered_map<std::string, Run> runs;
+    microsecond_t next_run_check = 0;
+    std::mutex runs_lock;
+
+    // ------------------------------------------------------------------------
+    // Only samples can be dropped when the output cannot keep up: definitions
+    // must always make it, as later samples may refer to them.
+    void inline commit(MojoBuffer& buffer, RecordKind kind = RECORD_EVENT)
+    {
+        writer->write(buffer.data(), buffer.size(), kind,
+                      kind == RECORD_SAMPLE ? sample_thread : std::string_view());
+
+        buffer.clear();
+    }
+
+    // ------------------------------------------------------------------------
+    // Buffer for events that belong to a sample, when there is one.
+    MojoBuffer inline& sample_event()
+    {
+        return in_sample ? sample_buffer : event_buffer;
+    }
+
+    void inline end_sample_event()
+    {
+        if (!in_sample)
+            commit(event_buffer);
+    }
+
+    // ------------------------------------------------------------------------
+    // Commit a definition. This is kept in the preamble too, under the same
+    // lock as restarts, so that no definition can fall between two outputs.
+    void inline define(MojoBuffer& buffer)
     {
-        output.put(static_cast<char>(event));
+        std::lock_guard<std::mutex> guard(preamble_lock);
+
+        // Heap snapshots are self-contained too.
+        if (writer->needs_preamble() || memory)
+            preamble.add(buffer.data(), buffer.size());
+
+        commit(buffer, RECORD_DEFINITION);
     }
-    void inline string(const std::string& string)
+
+    // ------------------------------------------------------------------------
+    void inline maybe_restart()
     {
-        output << string << '\0';
+        if (!writer->restart_due())
+            return;
+
+        std::lock_guard<std::mutex> guard(preamble_lock);
+
+        writer->restart(preamble.buffer());
     }
-    void inline string(const char* string)
+
+    // ------------------------------------------------------------------------
+    // Write out the aggregated samples. These are not droppable, as they stand
+    // for many samples each, and are committed in batches to reduce the
+    // number of writes.
+    void flush_aggregates()
     {
-        output << string << '\0';
+        static constexpr size_t BATCH_SIZE = 1 << 16;
+
+        MojoBuffer batch;
+
+        aggregator.flush([&](const std::string& sample, SampleAggregator::Aggregate& totals) {
+            batch.raw(sample.data(), sample.size());
+            batch.event(MOJO_METRIC_TIME);
+            batch.integer(totals.metric);
+
+            if (batch.size() >= BATCH_SIZE)
+                commit(batch, RECORD_SAMPLES);
+        });
+
+        if (!batch.empty())
+            commit(batch, RECORD_SAMPLES);
     }
-    void inline ref(mojo_ref_t value)
+
+    // ------------------------------------------------------------------------
+    // Everything in a sample between the stack event and the metric.
+    static void inline sample_stack(MojoBuffer& buffer, const SampleView& sample)
     {
-        integer(value);
+        if (sample.stack_key != 0)
+        {
+            buffer.event(MOJO_STACK_REF);
+            buffer.ref(sample.stack_key);
+            return;
+        }
+
+        for (auto i = sample.frame_count; i > 0; i--)
+        {
+            auto key = sample.frames[i - 1];
+            if (key == 0)
+            {
+                buffer.event(MOJO_FRAME_INVALID);
+            }
+            else
+            {
+                buffer.event(MOJO_FRAME_REF);
+                buffer.ref(key);
+            }
+        }
     }
-    void inline integer(mojo_int_t n)
+
+    // ------------------------------------------------------------------------
+    void end_run(Run& run)
     {
-        mojo_uint_t integer = n < 0 ? -n : n;
-        bool sign = n < 0;
+        run.sample.event(MOJO_METRIC_TIME);
+        run.sample.integer(run.metric);
+        run.sample.event(MOJO_SAMPLE_COUNT);
+        run.sample.integer(run.count);
+
+        writer->write(run.sample.data(), run.sample.size(), RECORD_SAMPLE, run.thread_name);
+
+        run.sample.clear();
+        run.count = 0;
+    }
 
-        unsigned char byte = integer & 0x3f;
-        if (sign)
-            byte |= 0x40;
+    // ------------------------------------------------------------------------
+    // Add a time sample to the run of its thread, or task, and end the run if
+    // the stack has changed. Runs that have gone on for too long are ended as
+    // well, including those of threads and tasks that are no longer sampled,
+    // which are then forgotten.
+    void fold_sample(const SampleView& sample)
+    {
+        static thread_local std::string key;
 
-        integer >>= 6;
-        if (integer)
-            byte |= 0x80;
+        key = *sample.thread_name;
+        key.push_back('\0');
+        if (sample.task_name != nullptr)
+            key += *sample.task_name;
+        key.append(reinterpret_cast<const char*>(&sample.iid), sizeof(sample.iid));
 
-        output.put(byte);
+        auto value = cpu ? sample.cpu_time : sample.delta;
+        auto now = sample_time;
+        microsecond_t deadline = fold * 1000000UL;
 
-        while (integer)
         {
-            byte = integer & 0x7f;
-            integer >>= 7;
-            if (integer)
-                byte |= 0x80;
-            output.put(byte);
+            std::lock_guard<std::mutex> guard(runs_lock);
+
+            auto& run = runs[key];
+
+            bool same = run.count > 0 && now - run.start < deadline &&
+                        (sample.stack_key != 0
+                             ? run.stack_key == sample.stack_key
+                             : run.stack_key == 0 && run.frames.size() == sample.frame_count &&
+                                   std::equal(run.frames.begin(), run.frames.end(), sample.frames));
+            if (same)
+            {
+                run.metric += value;
+                run.count++;
+            }
+            else
+            {
+                if (run.count > 0)
+                    end_run(run);
+
+                run.sample.event(MOJO_STACK);
+                run.sample.integer(sample.pid);
+                run.sample.integer(sample.iid);
+                run.sample.string(*sample.thread_name);
+                sample_stack(run.sample, sample);
+
+                run.thread_name = *sample.thread_name;
+                run.stack_key = sample.stack_key;
+                run.frames.assign(sample.frames, sample.frames + sample.frame_count);
+                run.metric = value;
+                run.count = 1;
+                run.start = now;
+            }
+
+            if (now >= next_run_check)
+            {
+                for (auto it = runs.begin(); it != runs.end();)
+                {
+                    auto& other = it->second;
+                    if (now - other.start < deadline)
+                    {
+                        ++it;
+                        continue;
+                    }
+
+                    if (other.count > 0)
+                        end_run(other);
+                    it = runs.erase(it);
+                }
+
+                next_run_check = now + deadline;
+            }
         }
+
+        maybe_restart();
+    }
+
+    // ------------------------------------------------------------------------
+    void flush_runs()
+    {
+        std::lock_guard<std::mutex> guard(runs_lock);
+
+        for (auto& [_, run] : runs)
+            if (run.count > 0)
+                end_run(run);
+
+        runs.clear();
+        next_run_check = 0;
     }
 
 public:
@@ -207,8 +510,13 @@ public:
 
     [[nodiscard]] Result<void> open() override
     {
-        output.open(std::getenv("ECHION_OUTPUT"));
-        if (!output.is_open())
+        // The previous writer has been closed by now, unless it was inherited
+        // across a fork, in which case it is abandoned.
+        if (!writer->forked())
+            delete writer;
+        writer = make_sink(std::getenv("ECHION_OUTPUT"));
+
+        if (!writer->open(std::getenv("ECHION_OUTPUT")))
         {
             std::cerr << "Failed to open output file " << std::getenv("ECHION_OUTPUT") << std::endl;
             return ErrorKind::RendererError;
@@ -217,121 +525,231 @@ public:
         return Result<void>::ok();
     }
 
+    // ------------------------------------------------------------------------
+    // The start of a self-contained MOJO stream, i.e. the header, the metadata
+    // and all the definitions, in memory mode. The header is for version 4 of
+    // the format, whatever the version of the output, as the samples of heap
+    // snapshots carry a count.
+    [[nodiscard]] Result<void> copy_preamble(MojoBuffer& output)
+    {
+        std::lock_guard<std::mutex> guard(preamble_lock);
+
+        if (preamble.empty())
+            return ErrorKind::RendererError;
+
+        // The preamble starts with the header, i.e. MOJ and the version.
+        auto& definitions = preamble.buffer();
+        auto* data = definitions.data();
+        size_t header_size = 3;
+        while (header_size < definitions.size() && (data[header_size] & 0x80))
+            header_size++;
+        header_size++;
+
+        if (header_size > definitions.size() || std::memcmp(data, "MOJ", 3) != 0)
+            return ErrorKind::RendererError;
+
+        output.raw("MOJ", 3);
+        output.integer(MOJO_VERSION_STACK_REFS);
+        output.raw(data + header_size, definitions.size() - header_size);
+
+        return Result<void>::ok();
+    }
+
+    // ------------------------------------------------------------------------
+    // Encode a whole sample, with its count, for a snapshot that is not
+    // written to the output. The stream must thus be of version 4.
+    static void encode_sample(MojoBuffer& buffer, const SampleView& sample)
+    {
+        buffer.event(MOJO_STACK);
+        buffer.integer(sample.pid);
+        buffer.integer(sample.iid);
+        buffer.string(*sample.thread_name);
+        sample_stack(buffer, sample);
+
+        if (sample.metric_type == MetricType::Memory)
+        {
+            buffer.event(MOJO_METRIC_MEMORY);
+            buffer.integer(sample.delta);
+        }
+        else
+        {
+            buffer.event(MOJO_METRIC_TIME);
+            buffer.integer(cpu ? sample.cpu_time : sample.delta);
+        }
+
+        buffer.event(MOJO_SAMPLE_COUNT);
+        buffer.integer(sample.count);
+    }
+
+    // ------------------------------------------------------------------------
+    // A self-contained MOJO stream with the samples held by the writer, if it
+    // keeps any.
+    [[nodiscard]] Result<void> snapshot(MojoBuffer& output)
+    {
+        flush_runs();
+        flush_aggregates();
+
+        std::lock_guard<std::mutex> guard(preamble_lock);
+
+        return writer->snapshot(preamble.buffer(), output);
+    }
+
     // ------------------------------------------------------------------------
     void close() override
     {
-        std::lock_guard<std::mutex> guard(lock);
+        flush_runs();
+        flush_aggregates();
 
-        output.flush();
-        output.close();
+        if (auto dropped = writer->dropped_records())
+            metadata("dropped_samples", std::to_string(dropped));
+
+        writer->close();
     }
 
     // ------------------------------------------------------------------------
     void inline header() override
     {
-        std::lock_guard<std::mutex> guard(lock);
+        {
+            std::lock_guard<std::mutex> guard(preamble_lock);
+
+            preamble.clear();
+        }
 
-        output << "MOJ";
-        integer(MOJO_VERSION);
+        event_buffer.raw("MOJ", 3);
+        // Folded samples carry their count.
+        event_buffer.integer(stack_refs || fold > 0 ? MOJO_VERSION_STACK_REFS : MOJO_VERSION);
+        define(event_buffer);
     }
 
     // ------------------------------------------------------------------------
     void inline metadata(const std::string& label, const std::string& value) override
     {
-        std::lock_guard<std::mutex> guard(lock);
-
-        event(MOJO_METADATA);
-        string(label);
-        string(value);
+        event_buffer.event(MOJO_METADATA);
+        event_buffer.string(label);
+        event_buffer.string(value);
+        define(event_buffer);
     }
 
     // ------------------------------------------------------------------------
     void inline stack(mojo_int_t pid, mojo_int_t iid, const std::string& thread_name)
     {
-        std::lock_guard<std::mutex> guard(lock);
-
-        event(MOJO_STACK);
-        integer(pid);
-        integer(iid);
-        string(thread_name);
+        // Drop whatever is left of a sample that was never completed.
+        sample_buffer.clear();
+        in_sample = true;
+        sample_thread = thread_name;
+
+        sample_buffer.event(MOJO_STACK);
+        sample_buffer.integer(pid);
+        sample_buffer.integer(iid);
+        sample_buffer.string(thread_name);
     }
 
     // ------------------------------------------------------------------------
     void inline frame(mojo_ref_t key, mojo_ref_t filename, mojo_ref_t name, mojo_int_t line,
                       mojo_int_t line_end, mojo_int_t column, mojo_int_t column_end) override
     {
-        std::lock_guard<std::mutex> guard(lock);
-
-        event(MOJO_FRAME);
-        ref(key);
-        ref(filename);
-        ref(name);
-        integer(line);
-        integer(line_end);
-        integer(column);
-        integer(column_end);
+        event_buffer.event(MOJO_FRAME);
+        event_buffer.ref(key);
+        event_buffer.ref(filename);
+        event_buffer.ref(name);
+        event_buffer.integer(line);
+        event_buffer.integer(line_end);
+        event_buffer.integer(column);
+        event_buffer.integer(column_end);
+        define(event_buffer);
     }
 
     // ------------------------------------------------------------------------
     void inline frame_ref(mojo_ref_t key) override
     {
-        std::lock_guard<std::mutex> guard(lock);
+        auto& buffer = sample_event();
 
         if (key == 0)
         {
-            event(MOJO_FRAME_INVALID);
+            buffer.event(MOJO_FRAME_INVALID);
         }
         else
         {
-            event(MOJO_FRAME_REF);
-            ref(key);
+            buffer.event(MOJO_FRAME_REF);
+            buffer.ref(key);
         }
+
+        end_sample_event();
     }
 
     // ------------------------------------------------------------------------
     void inline frame_kernel(const std::string& scope) override
     {
-        std::lock_guard<std::mutex> guard(lock);
+        auto& buffer = sample_event();
 
-        event(MOJO_FRAME_KERNEL);
-        string(scope);
+        buffer.event(MOJO_FRAME_KERNEL);
+        buffer.string(scope);
+
+        end_sample_event();
     }
 
     // ------------------------------------------------------------------------
     void inline metric_time(mojo_int_t value)
     {
-        std::lock_guard<std::mutex> guard(lock);
+        auto& buffer = sample_event();
 
-        event(MOJO_METRIC_TIME);
-        integer(value);
+        buffer.event(MOJO_METRIC_TIME);
+        buffer.integer(value);
+
+        end_sample_event();
     }
 
     // ------------------------------------------------------------------------
     void inline metric_memory(mojo_int_t value)
     {
-        std::lock_guard<std::mutex> guard(lock);
+        auto& buffer = sample_event();
 
-        event(MOJO_METRIC_MEMORY);
-        integer(value);
+        buffer.event(MOJO_METRIC_MEMORY);
+        buffer.integer(value);
+
+        end_sample_event();
     }
 
     // ------------------------------------------------------------------------
     void inline string(mojo_ref_t key, const std::string& value) override
     {
-        std::lock_guard<std::mutex> guard(lock);
-
-        event(MOJO_STRING);
-        ref(key);
-        string(value);
+        event_buffer.event(MOJO_STRING);
+        event_buffer.ref(key);
+        event_buffer.string(value);
+        define(event_buffer);
     }
 
     // ------------------------------------------------------------------------
     void inline string_ref(mojo_ref_t key) override
     {
-        std::lock_guard<std::mutex> guard(lock);
+        auto& buffer = sample_event();
+
+        buffer.event(MOJO_STRING_REF);
+        buffer.ref(key);
+
+        end_sample_event();
+    }
+
+    // ------------------------------------------------------------------------
+    void inline stack_def(mojo_ref_t key, const mojo_ref_t* frames, size_t count) override
+    {
+        event_buffer.event(MOJO_STACK_DEF);
+        event_buffer.ref(key);
+        event_buffer.integer(count);
+        while (count > 0)
+            event_buffer.ref(frames[--count]);
+        define(event_buffer);
+    }
+
+    // ------------------------------------------------------------------------
+    void inline stack_ref(mojo_ref_t key) override
+    {
+        auto& buffer = sample_event();
 
-        event(MOJO_STRING_REF);
-        ref(key);
+        buffer.event(MOJO_STACK_REF);
+        buffer.ref(key);
+
+        end_sample_event();
     }
 
     void render_message(std::string_view) override{};
@@ -349,6 +767,20 @@ public:
     };
     void render_stack_end(MetricType metric_type, uint64_t delta) override
     {
+        if (aggregate > 0 && in_sample && metric_type == MetricType::Time)
+        {
+            in_sample = false;
+            aggregator.add(sample_buffer.data(), sample_buffer.size(), cpu ? metric : delta);
+            sample_buffer.clear();
+
+            if (aggregator.due(aggregate))
+                flush_aggregates();
+
+            maybe_restart();
+
+            return;
+        }
+
         if (metric_type == MetricType::Time)
         {
             metric_time(cpu ? metric : delta);
@@ -357,109 +789,1348 @@ public:
         {
             metric_memory(delta);
         }
+
+        if (in_sample)
+        {
+            in_sample = false;
+            commit(sample_buffer, RECORD_SAMPLE);
+
+            // Restart between samples only.
+            maybe_restart();
+        }
     };
+
+    // ------------------------------------------------------------------------
+    void render_sample(const SampleView& sample) override
+    {
+        // Aggregation folds samples further, so there is no point in doing
+        // both.
+        if (fold > 0 && aggregate == 0 && sample.metric_type == MetricType::Time)
+        {
+            fold_sample(sample);
+            return;
+        }
+
+        stack(sample.pid, sample.iid, *sample.thread_name);
+        sample_stack(sample_buffer, sample);
+
+        metric = sample.cpu_time;
+        MojoRenderer::render_stack_end(sample.metric_type, sample.delta);
+    }
+
     bool is_valid() override
     {
         return true;
     }
 };
 
-class Renderer
+// ----------------------------------------------------------------------------
+// Base for the renderers that resolve frames themselves, rather than writing
+// references to them. The string, frame and stack definitions are kept as they
+// come in, and the frames of each sample are collected and resolved when the
+// sample ends, so that the lock is taken only once per sample.
+class ResolvingRenderer : public RendererInterface
 {
-private:
-    std::shared_ptr<RendererInterface> default_renderer = std::make_shared<MojoRenderer>();
-    std::weak_ptr<RendererInterface> currentRenderer;
-
-    std::shared_ptr<RendererInterface> getActiveRenderer()
+public:
+    [[nodiscard]] Result<void> open() override
     {
-        if (auto renderer = currentRenderer.lock())
-        {
-            if (renderer->is_valid())
-            {
-                return renderer;
-            }
-        }
-        return default_renderer;
-    }
-
-    Renderer() = default;
-    ~Renderer() = default;
+        std::lock_guard<std::mutex> guard(lock);
 
-public:
-    Renderer(const Renderer&) = delete;
-    Renderer& operator=(const Renderer&) = delete;
+        strings.clear();
+        frames.clear();
+        stacks.clear();
 
-    static Renderer& get()
-    {
-        static Renderer instance;
-        return instance;
+        return Result<void>::ok();
     }
 
-    void set_renderer(std::shared_ptr<RendererInterface> renderer)
+    void close() override {};
+    void header() override {};
+    void metadata(const std::string&, const std::string&) override {};
+
+    // ------------------------------------------------------------------------
+    void frame(mojo_ref_t key, mojo_ref_t filename, mojo_ref_t name, mojo_int_t line, mojo_int_t,
+               mojo_int_t, mojo_int_t) override
     {
-        currentRenderer = renderer;
+        std::lock_guard<std::mutex> guard(lock);
+
+        frames[key] = {filename, name, line};
     }
 
-    void header()
+    // ------------------------------------------------------------------------
+    void frame_ref(mojo_ref_t key) override
     {
-        getActiveRenderer()->header();
+        pending.push_back({PendingFrame::FRAME, key});
     }
 
-    void metadata(const std::string& label, const std::string& value)
+    // ------------------------------------------------------------------------
+    void frame_kernel(const std::string& scope) override
     {
-        getActiveRenderer()->metadata(label, value);
+        pending.push_back({PendingFrame::KERNEL, kernel_scopes.size()});
+        kernel_scopes.push_back(scope);
     }
 
-    void string(mojo_ref_t key, const std::string& value)
+    // ------------------------------------------------------------------------
+    void string(mojo_ref_t key, const std::string& value) override
     {
-        getActiveRenderer()->string(key, value);
+        std::lock_guard<std::mutex> guard(lock);
+
+        strings[key] = value;
     }
 
-    void frame(mojo_ref_t key, mojo_ref_t filename, mojo_ref_t name, mojo_int_t line,
-               mojo_int_t line_end, mojo_int_t column, mojo_int_t column_end)
+    void string_ref(mojo_ref_t) override {};
+
+    // ------------------------------------------------------------------------
+    void stack_def(mojo_ref_t key, const mojo_ref_t* stack_frames, size_t count) override
     {
-        getActiveRenderer()->frame(key, filename, name, line, line_end, column, column_end);
+        std::lock_guard<std::mutex> guard(lock);
+
+        stacks[key].assign(stack_frames, stack_frames + count);
     }
 
-    void frame_ref(mojo_ref_t key)
+    // ------------------------------------------------------------------------
+    void stack_ref(mojo_ref_t key) override
     {
-        getActiveRenderer()->frame_ref(key);
+        pending.push_back({PendingFrame::STACK, key});
     }
 
-    void frame_kernel(const std::string& scope)
+    void render_message(std::string_view) override {};
+    void render_thread_begin(PyThreadState*, std::string_view, microsecond_t, uintptr_t,
+                             unsigned long) override {};
+
+    // ------------------------------------------------------------------------
+    void render_task_begin(std::string name, bool) override
     {
-        getActiveRenderer()->frame_kernel(scope);
+        task_name = std::move(name);
     }
 
-    void string(mojo_ref_t key, const char* value)
+    // ------------------------------------------------------------------------
+    void render_stack_begin(long long pid, long long, const std::string& name) override
     {
-        getActiveRenderer()->string(key, value);
+        pending.clear();
+        kernel_scopes.clear();
+        sample_pid = pid;
+        thread_name = name;
     }
 
-    void string_ref(mojo_ref_t key)
+    void render_frame(Frame& frame) override;
+
+    void render_cpu_time(uint64_t cpu_time) override
     {
-        getActiveRenderer()->string_ref(key);
+        metric = cpu_time;
     }
 
-    void render_message(std::string_view msg)
+    void render_sample_count(uint64_t count) override
     {
-        getActiveRenderer()->render_message(msg);
+        sample_count = count;
     }
 
-    [[nodiscard]] Result<void> open()
+    // ------------------------------------------------------------------------
+    void render_stack_end(MetricType metric_type, uint64_t delta) override
     {
-        return getActiveRenderer()->open();
+        // Empty stacks carry no information, e.g. the sample that is emitted
+        // at startup to set the PID in the MOJO output.
+        if (!pending.empty())
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            sample(metric_type, metric_type == MetricType::Time && cpu ? metric : delta);
+        }
+
+        pending.clear();
+        kernel_scopes.clear();
+        task_name.clear();
+        sample_count = 1;
     }
 
-    void close()
+    // ------------------------------------------------------------------------
+    void render_sample(const SampleView& sample) override
+    {
+        ResolvingRenderer::render_stack_begin(sample.pid, sample.iid, *sample.thread_name);
+
+        if (sample.task_name != nullptr)
+            task_name = *sample.task_name;
+
+        if (sample.stack_key != 0)
+            pending.push_back({PendingFrame::STACK, sample.stack_key});
+        else
+            for (auto i = sample.frame_count; i > 0; i--)
+                pending.push_back({PendingFrame::FRAME, sample.frames[i - 1]});
+
+        metric = sample.cpu_time;
+        sample_count = sample.count;
+        ResolvingRenderer::render_stack_end(sample.metric_type, sample.delta);
+    }
+
+    // ------------------------------------------------------------------------
+    // Take the definitions received by another renderer, e.g. to render a
+    // snapshot of the samples of the session on its own.
+    void copy_definitions(ResolvingRenderer& other)
+    {
+        std::scoped_lock guard(lock, other.lock);
+
+        strings = other.strings;
+        frames = other.frames;
+        stacks = other.stacks;
+    }
+
+    bool is_valid() override
+    {
+        return true;
+    }
+
+protected:
+    // A frame of a sample, resolved from its definition.
+    struct ResolvedFrame
+    {
+        mojo_ref_t key;  // 0 for kernel frames
+        const std::string& name;
+        const std::string& filename;
+        mojo_int_t line;  // 0 for task names and other synthetic frames
+    };
+
+    // Information about the sample being rendered by the current thread
+    static inline thread_local long long sample_pid = 0;
+    static inline thread_local uint64_t sample_count = 1;
+    static inline thread_local std::string thread_name;
+    static inline thread_local std::string task_name;
+
+    // Guards the definitions and whatever state the renderer keeps
+    std::mutex lock;
+
+    // ------------------------------------------------------------------------
+    // Called with the lock held when a sample ends, with the value of its
+    // metric.
+    virtual void sample(MetricType metric_type, uint64_t value) = 0;
+
+    // ------------------------------------------------------------------------
+    // Call the given function on each frame of the current sample, from the
+    // root to the leaf. The lock must be held.
+    template <typename F>
+    void resolve(F on_frame)
+    {
+        for (auto& frame : pending)
+        {
+            switch (frame.kind)
+            {
+            case PendingFrame::FRAME:
+                on_frame(resolve_frame(frame.key));
+                break;
+            case PendingFrame::KERNEL:
+                on_frame(ResolvedFrame{0, kernel_scopes[frame.key], KERNEL_FILENAME, 0});
+                break;
+            case PendingFrame::STACK:
+            {
+                // Interned stacks go from the leaf to the root.
+                auto stack = stacks.find(frame.key);
+                if (stack != stacks.end())
+                    for (auto it = stack->second.rbegin(); it != stack->second.rend(); ++it)
+                        on_frame(resolve_frame(*it));
+                break;
+            }
+            }
+        }
+    }
+
+private:
+    struct FrameInfo
+    {
+        mojo_ref_t filename;
+        mojo_ref_t name;
+        mojo_int_t line;
+    };
+
+    struct PendingFrame
+    {
+        enum Kind
+        {
+            FRAME,   // A frame key
+            STACK,   // An interned stack key
+            KERNEL,  // An index into the kernel scopes
+        } kind;
+        uint64_t key;
+    };
+
+    static inline const std::string KERNEL_FILENAME = "<kernel>";
+    static inline const std::string INVALID_NAME = "<invalid>";
+    static inline const std::string UNKNOWN_NAME = "<unknown>";
+    static inline const std::string EMPTY;
+
+    static inline thread_local std::vector<PendingFrame> pending;
+    static inline thread_local std::vector<std::string> kernel_scopes;
+    static inline thread_local uint64_t metric = 0;
+
+    std::unordered_map<mojo_ref_t, std::string> strings;
+    std::unordered_map<mojo_ref_t, FrameInfo> frames;
+    std::unordered_map<mojo_ref_t, std::vector<mojo_ref_t>> stacks;
+
+    // ------------------------------------------------------------------------
+    const std::string& lookup(mojo_ref_t key)
+    {
+        auto it = strings.find(key);
+        return it == strings.end() ? UNKNOWN_NAME : it->second;
+    }
+
+    // ------------------------------------------------------------------------
+    ResolvedFrame resolve_frame(mojo_ref_t key)
+    {
+        auto it = frames.find(key);
+        if (it == frames.end())
+            return {key, INVALID_NAME, EMPTY, 0};
+
+        auto& frame = it->second;
+        return {key, lookup(frame.name), lookup(frame.filename), frame.line};
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Writes a pprof profile (profile.proto) when the sampler stops. Samples with
+// the same thread and stack are aggregated as they come in, so the size of the
+// profile grows with the number of unique stacks. The profile is gzipped if
+// the output file name ends with .gz.
+class PprofRenderer : public ResolvingRenderer
+{
+    struct Function
+    {
+        int64_t filename;
+        int64_t name;
+        int64_t start_line;
+    };
+
+    std::ofstream output;
+    std::string output_path;
+    std::chrono::system_clock::time_point start_time;
+
+    std::vector<std::string> comments;
+
+    // The profile tables. Location and function IDs are indices into the
+    // respective vectors, plus one.
+    std::vector<std::string> string_table;
+    std::unordered_map<std::string, int64_t> string_index;
+    std::vector<Function> functions;
+    std::map<std::pair<int64_t, int64_t>, uint64_t> function_index;
+    std::vector<std::pair<uint64_t, int64_t>> locations;  // Function ID and line
+    std::unordered_map<mojo_ref_t, uint64_t> location_index;
+    std::unordered_map<std::string, uint64_t> kernel_location_index;
+
+    // Aggregated samples, keyed by the thread name string index followed by
+    // the location IDs, from the leaf to the root.
+    struct Totals
+    {
+        int64_t count = 0;
+        int64_t value = 0;
+    };
+    std::map<std::vector<uint64_t>, Totals> samples;
+
+    // ------------------------------------------------------------------------
+    int64_t intern(const std::string& value)
+    {
+        auto it = string_index.find(value);
+        if (it != string_index.end())
+            return it->second;
+
+        string_table.push_back(value);
+        return string_index[value] = string_table.size() - 1;
+    }
+
+    // ------------------------------------------------------------------------
+    uint64_t new_location(const ResolvedFrame& frame)
+    {
+        auto filename_index = intern(frame.filename);
+        auto name_index = intern(frame.name);
+
+        auto function_key = std::make_pair(filename_index, name_index);
+        auto it = function_index.find(function_key);
+        uint64_t function_id;
+        if (it == function_index.end())
+        {
+            functions.push_back({filename_index, name_index, frame.line});
+            function_id = function_index[function_key] = functions.size();
+        }
+        else
+        {
+            function_id = it->second;
+        }
+
+        locations.emplace_back(function_id, frame.line);
+        return locations.size();
+    }
+
+    // ------------------------------------------------------------------------
+    uint64_t location(const ResolvedFrame& frame)
+    {
+        // Kernel frames have no key, so we tell them apart by name.
+        if (frame.key == 0)
+        {
+            auto it = kernel_location_index.find(frame.name);
+            if (it != kernel_location_index.end())
+                return it->second;
+
+            return kernel_location_index[frame.name] = new_location(frame);
+        }
+
+        auto it = location_index.find(frame.key);
+        if (it != location_index.end())
+            return it->second;
+
+        return location_index[frame.key] = new_location(frame);
+    }
+
+    // ------------------------------------------------------------------------
+    static void value_type(ProtoBuffer& message, int field, int64_t type, int64_t unit)
+    {
+        ProtoBuffer value_type;
+        value_type.int64(1, type);
+        value_type.int64(2, unit);
+        message.message(field, value_type);
+    }
+
+    // ------------------------------------------------------------------------
+    std::string encode()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        ProtoBuffer profile;
+
+        // Sample types: the number of samples, then the metric.
+        auto metric_type = intern(memory ? "inuse_space" : (cpu ? "cpu" : "wall"));
+        auto metric_unit = intern(memory ? "bytes" : "microseconds");
+        value_type(profile, 1, intern("samples"), intern("count"));
+        value_type(profile, 1, metric_type, metric_unit);
+
+        auto thread_label = intern("thread name");
+        for (auto& [key, totals] : samples)
+        {
+            ProtoBuffer sample;
+            sample.packed(1, std::vector<uint64_t>(key.begin() + 1, key.end()));
+            sample.packed(2, std::vector<int64_t>{totals.count, totals.value});
+
+            ProtoBuffer label;
+            label.int64(1, thread_label);
+            label.int64(2, key[0]);
+            sample.message(3, label);
+
+            profile.message(2, sample);
+        }
+
+        for (size_t i = 0; i < locations.size(); i++)
+        {
+            ProtoBuffer line;
+            line.uint64(1, locations[i].first);
+            line.int64(2, locations[i].second);
+
+            ProtoBuffer location;
+            location.uint64(1, i + 1);
+            location.message(4, line);
+            profile.message(4, location);
+        }
+
+        for (size_t i = 0; i < functions.size(); i++)
+        {
+            ProtoBuffer function;
+            function.uint64(1, i + 1);
+            function.int64(2, functions[i].name);
+            function.int64(3, functions[i].name);
+            function.int64(4, functions[i].filename);
+            function.int64(5, functions[i].start_line);
+            profile.message(5, function);
+        }
+
+        std::vector<int64_t> comment_indices;
+        for (auto& comment : comments)
+            comment_indices.push_back(intern(comment));
+
+        auto end_time = std::chrono::system_clock::now();
+        profile.int64(9, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             start_time.time_since_epoch())
+                             .count());
+        profile.int64(10, std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time)
+                              .count());
+        if (!memory)
+        {
+            value_type(profile, 11, metric_type, metric_unit);
+            profile.int64(12, interval);
+        }
+        for (auto index : comment_indices)
+            profile.int64(13, index);
+        profile.int64(14, metric_type);
+
+        // The string table goes last, as encoding the other fields can still
+        // add to it.
+        for (auto& value : string_table)
+            profile.string(6, value);
+
+        return profile.data();
+    }
+
+    // ------------------------------------------------------------------------
+    void reset()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        comments.clear();
+        string_table.assign(1, "");
+        string_index.clear();
+        string_index[""] = 0;
+        functions.clear();
+        function_index.clear();
+        locations.clear();
+        location_index.clear();
+        kernel_location_index.clear();
+        samples.clear();
+    }
+
+protected:
+    // ------------------------------------------------------------------------
+    void sample(MetricType, uint64_t value) override
+    {
+        static thread_local std::vector<uint64_t> key;
+        key.clear();
+        key.push_back(intern(thread_name));
+
+        resolve([&](const ResolvedFrame& frame) { key.push_back(location(frame)); });
+
+        // pprof wants locations from the leaf to the root.
+        std::reverse(key.begin() + 1, key.end());
+
+        auto& totals = samples[key];
+        totals.count += sample_count;
+        totals.value += value;
+    }
+
+public:
+    PprofRenderer() = default;
+
+    [[nodiscard]] Result<void> open() override
+    {
+        return open(std::getenv("ECHION_OUTPUT"));
+    }
+
+    [[nodiscard]] Result<void> open(const std::string& path)
+    {
+        reset();
+
+        output_path = path;
+        output.open(output_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!output.is_open())
+        {
+            std::cerr << "Failed to open output file " << output_path << std::endl;
+            return ErrorKind::RendererError;
+        }
+
+        start_time = std::chrono::system_clock::now();
+
+        return ResolvingRenderer::open();
+    }
+
+    // ------------------------------------------------------------------------
+    void close() override
+    {
+        if (!output.is_open())
+            return;
+
+        auto profile = encode();
+
+        auto gzipped = output_path.size() >= 3 &&
+                       output_path.compare(output_path.size() - 3, 3, ".gz") == 0;
+        if (gzipped)
+            profile = GzipEncoder::compress(profile);
+
+        output.write(profile.data(), profile.size());
+        output.close();
+
+        reset();
+    }
+
+    // ------------------------------------------------------------------------
+    void metadata(const std::string& label, const std::string& value) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        comments.push_back(label + ": " + value);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Decodes a MOJO stream, as written by the MojoRenderer, into the calls of
+// another renderer. This is used to convert flight recorder snapshots to other
+// formats. Events that carry no information for other renderers are skipped.
+class MojoReplay
+{
+public:
+    MojoReplay(const char* data, size_t size) : p(data), end(data + size) {}
+
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Result<void> replay(RendererInterface& renderer)
+    {
+        if (end - p < 3 || std::memcmp(p, "MOJ", 3) != 0)
+            return ErrorKind::RendererError;
+        p += 3;
+        integer();
+
+        std::vector<mojo_ref_t> stack;
+
+        while (p < end && !truncated)
+        {
+            auto event = static_cast<unsigned char>(*p++);
+
+            // A sample ends with its metric, unless its count follows.
+            if (event != MOJO_SAMPLE_COUNT)
+                end_sample(renderer);
+
+            switch (event)
+            {
+            case MOJO_METADATA:
+            {
+                auto label = string();
+                auto value = string();
+                renderer.metadata(label, value);
+                break;
+            }
+
+            case MOJO_STACK:
+            {
+                auto pid = integer();
+                auto iid = integer();
+                renderer.render_stack_begin(pid, iid, string());
+                break;
+            }
+
+            case MOJO_FRAME:
+            {
+                auto key = integer();
+                auto filename = integer();
+                auto name = integer();
+                auto line = integer();
+                auto line_end = integer();
+                auto column = integer();
+                auto column_end = integer();
+                renderer.frame(key, filename, name, line, line_end, column, column_end);
+                break;
+            }
+
+            case MOJO_FRAME_INVALID:
+                renderer.frame_ref(0);
+                break;
+
+            case MOJO_FRAME_REF:
+                renderer.frame_ref(integer());
+                break;
+
+            case MOJO_FRAME_KERNEL:
+                renderer.frame_kernel(string());
+                break;
+
+            case MOJO_METRIC_TIME:
+            {
+                auto value = integer();
+                renderer.render_cpu_time(value);
+                metric = {MetricType::Time, value};
+                break;
+            }
+
+            case MOJO_METRIC_MEMORY:
+                metric = {MetricType::Memory, integer()};
+                break;
+
+            case MOJO_STRING:
+            {
+                auto key = integer();
+                renderer.string(key, string());
+                break;
+            }
+
+            case MOJO_STRING_REF:
+                renderer.string_ref(integer());
+                break;
+
+            case MOJO_STACK_DEF:
+            {
+                // Frames are written from the root to the leaf.
+                auto key = integer();
+                auto count = integer();
+                stack.clear();
+                for (mojo_int_t i = 0; i < count && !truncated; i++)
+                    stack.push_back(integer());
+                std::reverse(stack.begin(), stack.end());
+                renderer.stack_def(key, stack.data(), stack.size());
+                break;
+            }
+
+            case MOJO_STACK_REF:
+                renderer.stack_ref(integer());
+                break;
+
+            case MOJO_SAMPLE_COUNT:
+            {
+                auto count = integer();
+                if (metric)
+                    renderer.render_sample_count(count);
+                end_sample(renderer);
+                break;
+            }
+
+            case MOJO_GC:
+            case MOJO_IDLE:
+                break;
+
+            default:
+                return ErrorKind::RendererError;
+            }
+        }
+
+        if (truncated)
+            return ErrorKind::RendererError;
+
+        end_sample(renderer);
+
+        return Result<void>::ok();
+    }
+
+private:
+    const char* p;
+    const char* end;
+    bool truncated = false;
+
+    // The metric of the sample being replayed, which is only rendered once we
+    // know whether a count follows.
+    std::optional<std::pair<MetricType, mojo_int_t>> metric;
+
+    // ------------------------------------------------------------------------
+    void end_sample(RendererInterface& renderer)
+    {
+        if (!metric)
+            return;
+
+        renderer.render_stack_end(metric->first, metric->second);
+        metric.reset();
+    }
+
+    // ------------------------------------------------------------------------
+    // See MojoBuffer::integer for the encoding.
+    mojo_int_t integer()
+    {
+        if (p >= end)
+        {
+            truncated = true;
+            return 0;
+        }
+
+        auto byte = static_cast<unsigned char>(*p++);
+        bool negative = byte & 0x40;
+        mojo_uint_t value = byte & 0x3f;
+        unsigned int shift = 6;
+
+        while (byte & 0x80)
+        {
+            if (p >= end || shift >= 64)
+            {
+                truncated = true;
+                return 0;
+            }
+
+            byte = static_cast<unsigned char>(*p++);
+            value |= static_cast<mojo_uint_t>(byte & 0x7f) << shift;
+            shift += 7;
+        }
+
+        return negative ? -static_cast<mojo_int_t>(value) : static_cast<mojo_int_t>(value);
+    }
+
+    // ------------------------------------------------------------------------
+    std::string string()
+    {
+        auto terminator = static_cast<const char*>(std::memchr(p, '\0', end - p));
+        if (terminator == nullptr)
+        {
+            truncated = true;
+            p = end;
+            return {};
+        }
+
+        std::string value(p, terminator);
+        p = terminator + 1;
+
+        return value;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Writes folded stacks, one "frame;frame;frame metric" line per unique stack,
+// ready to be turned into a flame graph. The thread name is used as the root
+// frame, and asyncio tasks and greenlets show up as a frame with the task name
+// where they start in the stack. Samples are
+// aggregated in memory and written out when the sampler stops, and at the
+// aggregation interval, if one is set. Tools that read this format sum the
+// metrics of identical stacks, so periodic flushes can simply be appended.
+class CollapsedRenderer : public ResolvingRenderer
+{
+    std::ofstream output;
+
+    SampleAggregator aggregator;
+
+    // ------------------------------------------------------------------------
+    // Semicolons separate frames, so they cannot appear within one.
+    static void append(std::string& folded, const std::string& name)
+    {
+        if (!folded.empty())
+            folded.push_back(';');
+
+        for (auto c : name)
+            folded.push_back(c == ';' ? ':' : c);
+    }
+
+    // ------------------------------------------------------------------------
+    void flush()
+    {
+        aggregator.flush([&](const std::string& folded, SampleAggregator::Aggregate& totals) {
+            // Flame graphs have no room for stacks that freed more memory than
+            // they allocated.
+            if (totals.metric > 0)
+                output << folded << " " << totals.metric << "\n";
+        });
+
+        output.flush();
+    }
+
+protected:
+    // ------------------------------------------------------------------------
+    void sample(MetricType, uint64_t value) override
+    {
+        static thread_local std::string folded;
+        folded.clear();
+
+        // Task stacks already have the task name as a synthetic frame.
+        append(folded, thread_name);
+
+        resolve([&](const ResolvedFrame& frame) {
+            // Task names and other synthetic frames have no location.
+            if (frame.line == 0)
+                append(folded, frame.name);
+            else
+                append(folded, frame.name + " (" + frame.filename + ":" +
+                                   std::to_string(frame.line) + ")");
+        });
+
+        // Memory deltas are signed.
+        aggregator.add(folded.data(), folded.size(), static_cast<int64_t>(value));
+
+        // Output happens under the lock too.
+        if (aggregate > 0 && aggregator.due(aggregate))
+            flush();
+    }
+
+public:
+    CollapsedRenderer() = default;
+
+    [[nodiscard]] Result<void> open() override
+    {
+        aggregator.clear();
+
+        output.open(std::getenv("ECHION_OUTPUT"), std::ios::out | std::ios::trunc);
+        if (!output.is_open())
+        {
+            std::cerr << "Failed to open output file " << std::getenv("ECHION_OUTPUT") << std::endl;
+            return ErrorKind::RendererError;
+        }
+
+        return ResolvingRenderer::open();
+    }
+
+    // ------------------------------------------------------------------------
+    void close() override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (!output.is_open())
+            return;
+
+        flush();
+        output.close();
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Writes a timeline of the samples in the JSON array flavour of the Trace Event
+// format, which can be loaded in Perfetto and chrome://tracing. Each thread,
+// and each asyncio task or greenlet, gets its own track. The frames of
+// consecutive samples of the same track are compared, so that a frame that
+// stays on the stack becomes a single slice, open from the first sample that
+// has it to the first one that does not. A track that is missing from a
+// sampling sweep has all its slices closed. Memory samples are not rendered.
+class TraceRenderer : public ResolvingRenderer
+{
+    struct Track
+    {
+        long long pid;
+        long long tid;
+        microsecond_t last_seen = 0;
+
+        // The open slices, from the root to the leaf, identified by their
+        // name and file name.
+        std::vector<std::pair<std::string, std::string>> stack;
+    };
+
+    std::ofstream output;
+    bool first_event = true;
+
+    // Tracks by native thread ID and task name, which is empty for the
+    // thread's own track. Tasks are given made-up IDs that are well beyond
+    // those of actual threads.
+    std::map<std::pair<unsigned long, std::string>, Track> tracks;
+    long long next_task_tid = 1LL << 32;
+
+    microsecond_t sweep_time = 0;
+
+    static inline thread_local unsigned long native_thread_id = 0;
+
+    // ------------------------------------------------------------------------
+    static void json_string(std::ostream& out, const std::string& value)
+    {
+        out << '"';
+        for (unsigned char c : value)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out << escaped;
+            }
+            else
+                out << c;
+        }
+        out << '"';
+    }
+
+    // ------------------------------------------------------------------------
+    std::ostream& event()
+    {
+        output << (first_event ? "[\n" : ",\n");
+        first_event = false;
+
+        return output;
+    }
+
+    // ------------------------------------------------------------------------
+    void track_name(long long pid, long long tid, const std::string& name)
+    {
+        event() << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << tid
+                << ",\"args\":{\"name\":";
+        json_string(output, name);
+        output << "}}";
+    }
+
+    // ------------------------------------------------------------------------
+    void begin(Track& track, microsecond_t ts, const ResolvedFrame& frame)
+    {
+        event() << "{\"ph\":\"B\",\"pid\":" << track.pid << ",\"tid\":" << track.tid
+                << ",\"ts\":" << ts
+                << ",\"name\":";
+        json_string(output, frame.name);
+        if (frame.line > 0)
+        {
+            output << ",\"args\":{\"file\":";
+            json_string(output, frame.filename);
+            output << ",\"line\":" << frame.line << "}";
+        }
+        output << "}";
+    }
+
+    // ------------------------------------------------------------------------
+    void end(Track& track, microsecond_t ts, size_t depth)
+    {
+        for (; track.stack.size() > depth; track.stack.pop_back())
+            event() << "{\"ph\":\"E\",\"pid\":" << track.pid << ",\"tid\":" << track.tid
+                    << ",\"ts\":" << ts << "}";
+    }
+
+    // ------------------------------------------------------------------------
+    // Close the slices of the tracks that were not sampled in the last sweep.
+    void end_sweep(microsecond_t ts)
+    {
+        for (auto& [_, track] : tracks)
+            if (track.last_seen < sweep_time && !track.stack.empty())
+                end(track, ts, 0);
+    }
+
+protected:
+    // ------------------------------------------------------------------------
+    void sample(MetricType metric_type, uint64_t) override
+    {
+        if (metric_type != MetricType::Time)
+            return;
+
+        if (sample_time != sweep_time)
+        {
+            end_sweep(sweep_time);
+            sweep_time = sample_time;
+        }
+
+        auto key = std::make_pair(native_thread_id, task_name);
+        auto it = tracks.find(key);
+        if (it == tracks.end())
+        {
+            auto tid = task_name.empty() ? static_cast<long long>(native_thread_id) : next_task_tid++;
+            it = tracks.emplace(key, Track{sample_pid, tid, 0, {}}).first;
+            track_name(sample_pid, tid,
+                       task_name.empty() ? thread_name : task_name + " (" + thread_name + ")");
+        }
+        auto& track = it->second;
+        track.last_seen = sweep_time;
+
+        // Keep the slices that are still on the stack, and start new ones for
+        // the frames that are not.
+        size_t depth = 0;
+        bool diverged = false;
+        resolve([&](const ResolvedFrame& frame) {
+            if (!diverged && depth < track.stack.size() && track.stack[depth].first == frame.name &&
+                track.stack[depth].second == frame.filename)
+            {
+                depth++;
+                return;
+            }
+
+            if (!diverged)
+            {
+                end(track, sweep_time, depth);
+                diverged = true;
+            }
+
+            begin(track, sweep_time, frame);
+            track.stack.emplace_back(frame.name, frame.filename);
+        });
+
+        if (!diverged)
+            end(track, sweep_time, depth);
+    }
+
+public:
+    TraceRenderer() = default;
+
+    [[nodiscard]] Result<void> open() override
+    {
+        tracks.clear();
+        first_event = true;
+        sweep_time = 0;
+
+        output.open(std::getenv("ECHION_OUTPUT"), std::ios::out | std::ios::trunc);
+        if (!output.is_open())
+        {
+            std::cerr << "Failed to open output file " << std::getenv("ECHION_OUTPUT") << std::endl;
+            return ErrorKind::RendererError;
+        }
+
+        return ResolvingRenderer::open();
+    }
+
+    // ------------------------------------------------------------------------
+    void close() override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (!output.is_open())
+            return;
+
+        // Whatever is still open lasts until the end of the last sweep.
+        for (auto& [_, track] : tracks)
+            end(track, sweep_time + interval, 0);
+
+        if (first_event)
+            output << "[";
+        output << "\n]\n";
+        output.close();
+    }
+
+    // ------------------------------------------------------------------------
+    void render_thread_begin(PyThreadState*, std::string_view, microsecond_t, uintptr_t,
+                             unsigned long native_id) override
+    {
+        native_thread_id = native_id;
+    }
+};
+
+class Renderer
+{
+private:
+    std::shared_ptr<MojoRenderer> mojo_renderer = std::make_shared<MojoRenderer>();
+    std::shared_ptr<RendererInterface> pprof_renderer = std::make_shared<PprofRenderer>();
+    std::shared_ptr<RendererInterface> collapsed_renderer = std::make_shared<CollapsedRenderer>();
+    std::shared_ptr<RendererInterface> trace_renderer = std::make_shared<TraceRenderer>();
+    // Chosen when the output is opened, and read from any thread, e.g. the
+    // where thread, or allocating threads in memory mode, so it is only
+    // accessed atomically.
+    std::shared_ptr<RendererInterface> default_renderer = mojo_renderer;
+    std::weak_ptr<RendererInterface> currentRenderer;
+    std::atomic<unsigned int> dumps = 0;
+
+    std::shared_ptr<RendererInterface> getActiveRenderer()
+    {
+        if (auto renderer = currentRenderer.lock())
+        {
+            if (renderer->is_valid())
+            {
+                return renderer;
+            }
+        }
+        return std::atomic_load(&default_renderer);
+    }
+
+    // The renderer pinned by the current thread, if any
+    static inline thread_local std::shared_ptr<RendererInterface> pinned_renderer;
+
+    // ------------------------------------------------------------------------
+    // Snapshots are numbered after the output, and are not compressed. The
+    // outputs that are not files have nothing to number snapshots after.
+    Result<std::string> snapshot_path(const char* path)
+    {
+        if (path != nullptr)
+            return std::string(path);
+
+        const char* output_path = std::getenv("ECHION_OUTPUT");
+        if (output_path == nullptr)
+            return ErrorKind::RendererError;
+
+        auto has_scheme = [&](const char* scheme) {
+            return std::strncmp(output_path, scheme, std::strlen(scheme)) == 0;
+        };
+        if (has_scheme(ShmRingWriter::SCHEME) || has_scheme(UnixSocketSink::SCHEME))
+            return ErrorKind::RendererError;
+        if (has_scheme(MappedFileWriter::SCHEME))
+            output_path += std::strlen(MappedFileWriter::SCHEME);
+
+        auto numbered = numbered_path(output_path, ++dumps);
+        if (numbered.size() > 3 && numbered.compare(numbered.size() - 3, 3, ".xz") == 0)
+            numbered.resize(numbered.size() - 3);
+
+        return numbered;
+    }
+
+    // ------------------------------------------------------------------------
+    static bool write_snapshot(const std::string& path, const MojoBuffer& snapshot)
+    {
+        std::ofstream output(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!output.is_open())
+            return false;
+
+        output.write(snapshot.data(), snapshot.size());
+
+        return static_cast<bool>(output);
+    }
+
+    Renderer() = default;
+    ~Renderer() = default;
+
+public:
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    static Renderer& get()
+    {
+        static Renderer instance;
+        return instance;
+    }
+
+    void set_renderer(std::shared_ptr<RendererInterface> renderer)
+    {
+        currentRenderer = renderer;
+    }
+
+    // ------------------------------------------------------------------------
+    // Resolving the active renderer takes a weak pointer lock, so the sampler
+    // pins it for the current thread for the duration of a sweep. Threads and
+    // samples are rendered with the pinned renderer, if there is one.
+    void pin()
+    {
+        pinned_renderer = getActiveRenderer();
+    }
+
+    void unpin()
+    {
+        pinned_renderer.reset();
+    }
+
+    void header()
+    {
+        getActiveRenderer()->header();
+    }
+
+    void metadata(const std::string& label, const std::string& value)
+    {
+        getActiveRenderer()->metadata(label, value);
+    }
+
+    void string(mojo_ref_t key, const std::string& value)
+    {
+        getActiveRenderer()->string(key, value);
+    }
+
+    void frame(mojo_ref_t key, mojo_ref_t filename, mojo_ref_t name, mojo_int_t line,
+               mojo_int_t line_end, mojo_int_t column, mojo_int_t column_end)
+    {
+        getActiveRenderer()->frame(key, filename, name, line, line_end, column, column_end);
+    }
+
+    void frame_ref(mojo_ref_t key)
+    {
+        getActiveRenderer()->frame_ref(key);
+    }
+
+    void frame_kernel(const std::string& scope)
+    {
+        getActiveRenderer()->frame_kernel(scope);
+    }
+
+    void string(mojo_ref_t key, const char* value)
+    {
+        getActiveRenderer()->string(key, value);
+    }
+
+    void string_ref(mojo_ref_t key)
+    {
+        getActiveRenderer()->string_ref(key);
+    }
+
+    void stack_def(mojo_ref_t key, const mojo_ref_t* frames, size_t count)
+    {
+        getActiveRenderer()->stack_def(key, frames, count);
+    }
+
+    void stack_ref(mojo_ref_t key)
+    {
+        getActiveRenderer()->stack_ref(key);
+    }
+
+    void render_message(std::string_view msg)
+    {
+        getActiveRenderer()->render_message(msg);
+    }
+
+    [[nodiscard]] Result<void> open()
+    {
+        // The output format is chosen for the whole session when the output
+        // is opened. The flight recorder keeps MOJO data, which is converted
+        // when it is dumped.
+        dumps = 0;
+        std::shared_ptr<RendererInterface> renderer = mojo_renderer;
+        switch (flight_recorder > 0 ? OUTPUT_FORMAT_MOJO : output_format)
+        {
+        case OUTPUT_FORMAT_PPROF:
+            renderer = pprof_renderer;
+            break;
+        case OUTPUT_FORMAT_COLLAPSED:
+            renderer = collapsed_renderer;
+            break;
+        case OUTPUT_FORMAT_TRACE:
+            renderer = trace_renderer;
+            break;
+        default:
+            break;
+        }
+        std::atomic_store(&default_renderer, renderer);
+
+        return getActiveRenderer()->open();
+    }
+
+    void close()
     {
         getActiveRenderer()->close();
     }
 
+    // ------------------------------------------------------------------------
+    // Write the samples held by the flight recorder to the given path, or to a
+    // new numbered file next to the output, in the output format. Returns the
+    // path of the dump.
+    [[nodiscard]] Result<std::string> dump(const char* path)
+    {
+        if (flight_recorder == 0)
+            return ErrorKind::RendererError;
+
+        auto maybe_dump_path = snapshot_path(path);
+        if (!maybe_dump_path)
+            return ErrorKind::RendererError;
+
+        auto& dump_path = *maybe_dump_path;
+
+        MojoBuffer snapshot;
+        if (!mojo_renderer->snapshot(snapshot))
+            return ErrorKind::RendererError;
+
+        if (output_format == OUTPUT_FORMAT_PPROF)
+        {
+            PprofRenderer pprof;
+            if (!pprof.open(dump_path))
+                return ErrorKind::RendererError;
+
+            auto replayed = MojoReplay(snapshot.data(), snapshot.size()).replay(pprof);
+            pprof.close();
+            if (!replayed)
+                return ErrorKind::RendererError;
+
+            return dump_path;
+        }
+
+        if (!write_snapshot(dump_path, snapshot))
+            return ErrorKind::RendererError;
+
+        return dump_path;
+    }
+
+    // ------------------------------------------------------------------------
+    // Write the samples produced by the given function, which is called with
+    // a function that takes each sample, to the given path, or to a new
+    // numbered file next to the output. The samples are written in the MOJO
+    // format, with all the definitions of the session, or as a pprof profile
+    // when the output format resolves frames itself. Returns the path of the
+    // snapshot.
+    template <typename F>
+    [[nodiscard]] Result<std::string> heap_snapshot(const char* path, F for_each_sample)
+    {
+        auto maybe_path = snapshot_path(path);
+        if (!maybe_path)
+            return ErrorKind::RendererError;
+
+        auto& heap_path = *maybe_path;
+
+        auto renderer = std::atomic_load(&default_renderer);
+
+        if (renderer == mojo_renderer)
+        {
+            MojoBuffer snapshot;
+            if (!mojo_renderer->copy_preamble(snapshot))
+                return ErrorKind::RendererError;
+
+            for_each_sample(
+                [&](const SampleView& sample) { MojoRenderer::encode_sample(snapshot, sample); });
+
+            if (!write_snapshot(heap_path, snapshot))
+                return ErrorKind::RendererError;
+
+            return heap_path;
+        }
+
+        auto resolving = std::dynamic_pointer_cast<ResolvingRenderer>(renderer);
+        if (!resolving)
+            return ErrorKind::RendererError;
+
+        PprofRenderer pprof;
+        if (!pprof.open(heap_path))
+            return ErrorKind::RendererError;
+
+        pprof.copy_definitions(*resolving);
+        for_each_sample([&](const SampleView& sample) { pprof.render_sample(sample); });
+        pprof.close();
+
+        return heap_path;
+    }
+
     void render_thread_begin(PyThreadState* tstate, std::string_view name, microsecond_t cpu_time,
                              uintptr_t thread_id, unsigned long native_id)
     {
-        getActiveRenderer()->render_thread_begin(tstate, name, cpu_time, thread_id, native_id);
+        if (pinned_renderer)
+            pinned_renderer->render_thread_begin(tstate, name, cpu_time, thread_id, native_id);
+        else
+            getActiveRenderer()->render_thread_begin(tstate, name, cpu_time, thread_id, native_id);
     }
 
     void render_task_begin(std::string task_name, bool on_cpu)
@@ -486,4 +2157,12 @@ public:
     {
         getActiveRenderer()->render_stack_end(metric_type, delta);
     }
+
+    void render_sample(const SampleView& sample)
+    {
+        if (pinned_renderer)
+            pinned_renderer->render_sample(sample);
+        else
+            getActiveRenderer()->render_sample(sample);
+    }
 };
@@ -0,0 +1,355 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <echion/config.h>
+#include <echion/errors.h>
+#include <echion/mojo.h>
+#include <echion/sink.h>
+
+// ----------------------------------------------------------------------------
+// Shared memory ring layout. The ring is a POSIX shared memory object, i.e.
+// /dev/shm/<name> on Linux, made of a header page followed by the data area.
+// All integers are in the byte order of the host.
+//
+//   offset  size  field
+//        0     8  magic, "ECHORING"
+//        8     4  version of the layout, currently 1
+//       12     4  offset of the data area from the start of the object
+//       16     8  capacity of the data area in bytes, a power of two
+//       24     8  PID of the producer
+//       32     4  state: 0 while being set up, 1 open, 2 closed
+//       64     8  write sequence: bytes published by the producer
+//      128     8  read sequence: bytes consumed by the consumer
+//      192     8  number of samples dropped because the ring was full
+//      200     8  number of restarts, i.e. of records with the RESET flag
+//      208     8  how many of the dropped samples were batches of aggregated
+//                 samples
+//
+// The sequences only ever grow, and the position in the data area is the
+// sequence modulo the capacity. Records start at multiples of 8 bytes with an
+// 8-byte header, the size of the payload (4 bytes) followed by flags (4
+// bytes), and never wrap around the end of the data area. Flags are:
+//
+//   1  PADDING    the rest of the data area is unused, skip to its start
+//   2  RESET      the payload starts a new MOJO stream, with the header, and
+//                 ends any stream in progress
+//   4  CONTINUED  the payload is continued by the next record
+//
+// The payload of every other record is a whole number of MOJO events, i.e.
+// a sample or a definition, that follows on from the previous records. The
+// preamble of a new stream can be larger than the ring, so it is split into a
+// RESET record followed by as many records as needed, all but the last with
+// the CONTINUED flag, and events can straddle them.
+//
+// The producer publishes records with a release store of the write sequence,
+// and the consumer releases space with a release store of the read sequence,
+// once it is done with the records. The producer never waits for the
+// consumer: when the ring is full, samples are dropped and counted. If a
+// definition is dropped, the stream can no longer be decoded, so the producer
+// drops everything until it has published the whole preamble, starting with a
+// RESET record, from which the consumer can start afresh. The preamble is
+// published as room is made by the consumer, and definitions made meanwhile
+// are published with it. Anything but a definition that is dropped meanwhile
+// is counted as a lost sample, and a batch of aggregated samples, which
+// stands for many, is counted in the dropped batches too.
+struct ShmRingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t data_offset;
+    uint64_t capacity;
+    uint64_t pid;
+    std::atomic<uint32_t> state;
+
+    alignas(64) std::atomic<uint64_t> write_seq;
+    alignas(64) std::atomic<uint64_t> read_seq;
+    alignas(64) std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> resets;
+    std::atomic<uint64_t> dropped_batches;
+};
+
+static_assert(offsetof(ShmRingHeader, write_seq) == 64, "Unexpected shared memory ring layout");
+static_assert(offsetof(ShmRingHeader, resets) == 200, "Unexpected shared memory ring layout");
+static_assert(offsetof(ShmRingHeader, dropped_batches) == 208,
+              "Unexpected shared memory ring layout");
+
+// ----------------------------------------------------------------------------
+class ShmRingWriter : public OutputSink
+{
+public:
+    static constexpr const char* SCHEME = "shm:";
+
+    enum RecordFlags
+    {
+        RECORD_PADDING = 1,
+        RECORD_RESET = 2,
+        RECORD_CONTINUED = 4,
+    };
+
+    enum State
+    {
+        STATE_INIT = 0,
+        STATE_OPEN = 1,
+        STATE_CLOSED = 2,
+    };
+
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Result<void> open(const char* output) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        // shm:NAME is published as /NAME.
+        name = output + std::strlen(SCHEME);
+        if (name.empty() || name[0] != '/')
+            name = "/" + name;
+
+        capacity = 4096;
+        while (capacity < shm_size)
+            capacity <<= 1;
+
+        size = HEADER_SIZE + capacity;
+
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            return ErrorKind::RendererError;
+
+        if (ftruncate(fd, size) != 0)
+        {
+            ::close(fd);
+            return ErrorKind::RendererError;
+        }
+
+        auto* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            return ErrorKind::RendererError;
+
+        header = new (mapping) ShmRingHeader();
+        data = static_cast<char*>(mapping) + HEADER_SIZE;
+
+        std::memcpy(header->magic, "ECHORING", sizeof(header->magic));
+        header->version = 1;
+        header->data_offset = HEADER_SIZE;
+        header->capacity = capacity;
+        header->pid = getpid();
+        header->write_seq.store(0, std::memory_order_relaxed);
+        header->read_seq.store(0, std::memory_order_relaxed);
+        header->dropped.store(0, std::memory_order_relaxed);
+        header->resets.store(0, std::memory_order_relaxed);
+        header->dropped_batches.store(0, std::memory_order_relaxed);
+        header->state.store(STATE_OPEN, std::memory_order_release);
+
+        write_seq = 0;
+        dropped = 0;
+        dropped_batches = 0;
+        resync = false;
+        pending.clear();
+        pending_offset = 0;
+        owner = getpid();
+
+        return Result<void>::ok();
+    }
+
+    // ------------------------------------------------------------------------
+    // The object is left behind for the consumer to read what is left, and
+    // to unlink it.
+    void close() override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (header == nullptr)
+            return;
+
+        header->state.store(STATE_CLOSED, std::memory_order_release);
+
+        munmap(header, size);
+        header = nullptr;
+        data = nullptr;
+    }
+
+    // ------------------------------------------------------------------------
+    bool write(const char* record, size_t record_size, RecordKind kind, std::string_view) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (header == nullptr)
+            return false;
+
+        // Definitions are part of the preamble, which is published in full
+        // when resynchronising, so they can be skipped until then.
+        if (!resync && publish(record, record_size, 0))
+            return true;
+
+        if (kind == RECORD_DEFINITION)
+        {
+            // Definitions made while the preamble is being published go out
+            // with it, as it is a copy.
+            if (!pending.empty())
+            {
+                pending.append(record, record_size);
+                return true;
+            }
+
+            resync = true;
+            return false;
+        }
+
+        dropped++;
+        header->dropped.store(dropped, std::memory_order_relaxed);
+
+        if (kind == RECORD_SAMPLES)
+        {
+            dropped_batches++;
+            header->dropped_batches.store(dropped_batches, std::memory_order_relaxed);
+        }
+
+        return false;
+    }
+
+    // ------------------------------------------------------------------------
+    bool needs_preamble() const override
+    {
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool restart_due() override
+    {
+        return resync;
+    }
+
+    // ------------------------------------------------------------------------
+    void restart(const MojoBuffer& preamble) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (header == nullptr || !resync)
+            return;
+
+        // We keep a copy of the preamble, as it might change before there is
+        // room for all of it.
+        if (pending.empty())
+        {
+            pending.assign(preamble.data(), preamble.size());
+            pending_offset = 0;
+        }
+
+        // Smaller records fit in the ring before the consumer has freed all
+        // of it.
+        size_t max_payload = capacity / 4 - RECORD_HEADER_SIZE;
+
+        while (pending_offset < pending.size())
+        {
+            size_t payload_size = std::min(pending.size() - pending_offset, max_payload);
+
+            uint32_t flags = pending_offset == 0 ? RECORD_RESET : 0;
+            if (pending_offset + payload_size < pending.size())
+                flags |= RECORD_CONTINUED;
+
+            if (!publish(pending.data() + pending_offset, payload_size, flags))
+                return;  // Carry on when there is more room
+
+            if (pending_offset == 0)
+                header->resets.fetch_add(1, std::memory_order_relaxed);
+
+            pending_offset += payload_size;
+        }
+
+        resync = false;
+        pending.clear();
+    }
+
+    // ------------------------------------------------------------------------
+    size_t dropped_records() override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        return dropped;
+    }
+
+    // ------------------------------------------------------------------------
+    bool forked() const override
+    {
+        return owner != 0 && owner != getpid();
+    }
+
+private:
+    static constexpr uint32_t HEADER_SIZE = 4096;
+    static constexpr size_t RECORD_HEADER_SIZE = 8;
+
+    std::string name;
+    size_t capacity = 0;
+    size_t size = 0;
+    ShmRingHeader* header = nullptr;
+    char* data = nullptr;
+
+    // Only the producer writes the write sequence, so we keep our own copy.
+    uint64_t write_seq = 0;
+    size_t dropped = 0;
+    size_t dropped_batches = 0;
+    std::atomic<bool> resync = false;
+    pid_t owner = 0;
+
+    // The preamble being published while resynchronising, with the
+    // definitions made since, and how much of it has been published.
+    std::string pending;
+    size_t pending_offset = 0;
+
+    std::mutex lock;
+
+    // ------------------------------------------------------------------------
+    inline void record_header(size_t offset, uint32_t payload_size, uint32_t flags)
+    {
+        std::memcpy(data + offset, &payload_size, sizeof(payload_size));
+        std::memcpy(data + offset + sizeof(payload_size), &flags, sizeof(flags));
+    }
+
+    // ------------------------------------------------------------------------
+    // Returns false if there is no room for the record.
+    bool publish(const char* payload, size_t payload_size, uint32_t flags)
+    {
+        size_t record_size = (RECORD_HEADER_SIZE + payload_size + 7) & ~static_cast<size_t>(7);
+        if (record_size > capacity)
+            return false;
+
+        size_t offset = write_seq & (capacity - 1);
+        size_t contiguous = capacity - offset;
+        size_t needed = record_size + (contiguous < record_size ? contiguous : 0);
+
+        auto read_seq = header->read_seq.load(std::memory_order_acquire);
+        if (capacity - (write_seq - read_seq) < needed)
+            return false;
+
+        if (contiguous < record_size)
+        {
+            record_header(offset, static_cast<uint32_t>(contiguous - RECORD_HEADER_SIZE),
+                          RECORD_PADDING);
+            write_seq += contiguous;
+            offset = 0;
+        }
+
+        record_header(offset, static_cast<uint32_t>(payload_size), flags);
+        std::memcpy(data + offset + RECORD_HEADER_SIZE, payload, payload_size);
+        write_seq += record_size;
+
+        header->write_seq.store(write_seq, std::memory_order_release);
+
+        return true;
+    }
+};
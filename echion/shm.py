@@ -0,0 +1,146 @@
+# This file is part of "echion" which is released under MIT.
+#
+# Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+"""Reader for the shared memory ring output (-o shm:NAME).
+
+The layout of the ring is documented in echion/shm.h. This is a reference
+implementation that relies on aligned 8-byte reads and writes being atomic,
+which is the case on the platforms we support.
+"""
+
+import mmap
+import os
+import struct
+import sys
+import time
+import typing as t
+from pathlib import Path
+
+MAGIC = b"ECHORING"
+
+STATE_OPEN = 1
+STATE_CLOSED = 2
+
+RECORD_PADDING = 1
+RECORD_RESET = 2
+
+WRITE_SEQ = 64
+READ_SEQ = 128
+DROPPED = 192
+RESETS = 200
+DROPPED_BATCHES = 208
+
+
+class ShmRingReader:
+    def __init__(self, name: str) -> None:
+        self.path = Path("/dev/shm") / name.lstrip("/")
+
+        with self.path.open("r+b") as f:
+            self.mmap = mmap.mmap(f.fileno(), 0)
+
+        magic, version, self.data_offset, self.capacity, self.pid = struct.unpack_from(
+            "=8sIIQQ", self.mmap, 0
+        )
+        if magic != MAGIC or version != 1:
+            raise ValueError(f"{self.path} is not an echion ring")
+
+        self.read_seq = self._u64(READ_SEQ)
+
+    def _u64(self, offset: int) -> int:
+        return struct.unpack_from("=Q", self.mmap, offset)[0]
+
+    @property
+    def closed(self) -> bool:
+        return struct.unpack_from("=I", self.mmap, 32)[0] == STATE_CLOSED
+
+    @property
+    def dropped(self) -> int:
+        return self._u64(DROPPED)
+
+    @property
+    def dropped_batches(self) -> int:
+        return self._u64(DROPPED_BATCHES)
+
+    @property
+    def resets(self) -> int:
+        return self._u64(RESETS)
+
+    def read(self) -> t.Iterator[t.Tuple[bytes, bool]]:
+        """Consume the records published so far.
+
+        Yields the payload of each record, and whether it starts a new MOJO
+        stream, in which case everything before it should be discarded. The
+        payloads of a stream are to be concatenated, as events can straddle
+        records.
+        """
+        write_seq = self._u64(WRITE_SEQ)
+
+        while self.read_seq < write_seq:
+            offset = self.data_offset + (self.read_seq & (self.capacity - 1))
+            size, flags = struct.unpack_from("=II", self.mmap, offset)
+
+            if flags & RECORD_PADDING:
+                self.read_seq += 8 + size
+                continue
+
+            payload = self.mmap[offset + 8 : offset + 8 + size]
+            self.read_seq += (8 + size + 7) & ~7
+
+            yield payload, bool(flags & RECORD_RESET)
+
+        # Give the space back to the producer.
+        struct.pack_into("=Q", self.mmap, READ_SEQ, self.read_seq)
+
+    def unlink(self) -> None:
+        self.mmap.close()
+        os.unlink(self.path)
+
+
+def main() -> None:
+    """Drain the ring into a MOJO file until the sampler stops."""
+    try:
+        name, output = sys.argv[1:]
+    except ValueError:
+        print("usage: python -m echion.shm NAME OUTPUT", file=sys.stderr)
+        sys.exit(1)
+
+    reader = ShmRingReader(name)
+
+    # Samples were lost before every reset, so the stream that follows is
+    # written to a new file, i.e. OUTPUT.1, OUTPUT.2, ...
+    streams = 0
+    f = open(output, "wb")
+
+    try:
+        while True:
+            # Check before reading, so that nothing is left behind.
+            closed = reader.closed
+
+            for payload, reset in reader.read():
+                if reset:
+                    f.close()
+                    streams += 1
+                    f = open(f"{output}.{streams}", "wb")
+                f.write(payload)
+
+            if closed:
+                break
+
+            time.sleep(0.1)
+    finally:
+        f.close()
+
+    if reader.dropped:
+        batches = reader.dropped_batches
+        print(
+            f"{reader.dropped} samples dropped"
+            + (f", {batches} of which batches of aggregated samples" if batches else ""),
+            file=sys.stderr,
+        )
+
+    reader.unlink()
+
+
+if __name__ == "__main__":
+    main()
@@ -7,6 +7,7 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include <atomic>
 #include <csignal>
 #include <mutex>
 
@@ -17,6 +18,14 @@
 
 inline std::mutex sigprof_handler_lock;
 
+// Set when a flight recorder dump is requested with SIGUSR2, and served by the
+// sampler, as the dump cannot be taken within the handler.
+inline std::atomic<bool> dump_requested = false;
+
+// Set when a heap snapshot is requested with SIGUSR1, in memory mode, and
+// served by the sampler.
+inline std::atomic<bool> heap_snapshot_requested = false;
+
 // ----------------------------------------------------------------------------
 inline void sigprof_handler([[maybe_unused]] int signum)
 {
@@ -37,6 +46,49 @@ inline void sigquit_handler([[maybe_unused]] int signum)
     where_cv.notify_one();
 }
 
+// ----------------------------------------------------------------------------
+inline void sigusr2_handler([[maybe_unused]] int signum)
+{
+    dump_requested = true;
+}
+
+// ----------------------------------------------------------------------------
+inline void sigusr1_handler([[maybe_unused]] int signum)
+{
+    heap_snapshot_requested = true;
+}
+
+// ----------------------------------------------------------------------------
+// The signals that trigger dumps and snapshots might be used by the
+// application too, so the handlers that were in place are saved, and put back
+// when the sampler stops.
+inline struct sigaction previous_sigusr1;
+inline struct sigaction previous_sigusr2;
+
+// ----------------------------------------------------------------------------
+inline void install_handler(int signum, void (*handler)(int), struct sigaction& previous)
+{
+    struct sigaction action = {};
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+
+    sigaction(signum, &action, &previous);
+}
+
+// ----------------------------------------------------------------------------
+// Put the previous handler back, unless the application has replaced ours in
+// the meantime.
+inline void restore_handler(int signum, void (*handler)(int), const struct sigaction& previous)
+{
+    struct sigaction current;
+    if (sigaction(signum, nullptr, &current) != 0 || (current.sa_flags & SA_SIGINFO) ||
+        current.sa_handler != handler)
+        return;
+
+    sigaction(signum, &previous, nullptr);
+}
+
 // ----------------------------------------------------------------------------
 inline void install_signals()
 {
@@ -44,6 +96,12 @@ inline void install_signals()
 
     if (native)
         signal(SIGPROF, sigprof_handler);
+
+    if (flight_recorder > 0)
+        install_handler(SIGUSR2, sigusr2_handler, previous_sigusr2);
+
+    if (memory && heap_snapshot_signal)
+        install_handler(SIGUSR1, sigusr1_handler, previous_sigusr1);
 }
 
 // ----------------------------------------------------------------------------
@@ -53,4 +111,10 @@ inline void restore_signals()
 
     if (native)
         signal(SIGPROF, SIG_DFL);
+
+    if (flight_recorder > 0)
+        restore_handler(SIGUSR2, sigusr2_handler, previous_sigusr2);
+
+    if (memory && heap_snapshot_signal)
+        restore_handler(SIGUSR1, sigusr1_handler, previous_sigusr1);
 }
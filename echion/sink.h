@@ -0,0 +1,88 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include <echion/errors.h>
+#include <echion/mojo.h>
+
+// ----------------------------------------------------------------------------
+// What a record holds. Only single samples can be dropped because of
+// back-pressure: anything else is either needed to decode later samples, or
+// stands for many samples.
+enum RecordKind
+{
+    RECORD_EVENT,       // Any other event
+    RECORD_DEFINITION,  // Header, metadata, strings, frames and stacks
+    RECORD_SAMPLE,      // A single sample
+    RECORD_SAMPLES,     // A batch of aggregated samples
+};
+
+// ----------------------------------------------------------------------------
+// Where the MOJO output goes. Records are complete events, or complete
+// samples, and are written by many threads. Sinks that can restart the output
+// (e.g. to rotate a file) ask for it with restart_due, and are then handed the
+// preamble, that is the header, the metadata and all the definitions emitted
+// so far, so that the new output can be read on its own.
+class OutputSink
+{
+public:
+    virtual ~OutputSink() = default;
+
+    [[nodiscard]] virtual Result<void> open(const char* output) = 0;
+
+    // Write out everything that has been written so far. Records written
+    // after this are discarded.
+    virtual void close() = 0;
+
+    // Returns false if the record was dropped. The thread is the name of the
+    // thread of single samples.
+    virtual bool write(const char* data, size_t size, RecordKind kind,
+                       std::string_view thread) = 0;
+
+    // Whether the renderer must keep the preamble for restarts.
+    virtual bool needs_preamble() const = 0;
+
+    // Whether the output should be restarted with the preamble.
+    virtual bool restart_due() = 0;
+
+    // Restart the output with the given preamble. This is a no-op if another
+    // thread has restarted the output in the meantime.
+    virtual void restart(const MojoBuffer& preamble) = 0;
+
+    virtual size_t dropped_records() = 0;
+
+    // A sink inherited across a fork might have lost its threads, and possibly
+    // its locks, so it must be abandoned rather than reused.
+    virtual bool forked() const = 0;
+
+    // Make a self-contained MOJO stream, starting with the given preamble, out
+    // of the samples held by the sink. Only sinks that hold on to samples can
+    // do this.
+    [[nodiscard]] virtual Result<void> snapshot(const MojoBuffer&, MojoBuffer&)
+    {
+        return ErrorKind::RendererError;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Outputs that are split into many files are numbered before the first
+// extension of the file name, e.g. 42.echion.xz -> 42-0003.echion.xz.
+inline std::string numbered_path(const std::string& path, unsigned int number)
+{
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), "-%04u", number);
+
+    auto name = path.find_last_of('/');
+    auto dot = path.find('.', name == std::string::npos ? 0 : name + 1);
+    if (dot == std::string::npos)
+        return path + suffix;
+
+    return path.substr(0, dot) + suffix + path.substr(dot);
+}
@@ -0,0 +1,405 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <echion/config.h>
+#include <echion/errors.h>
+#include <echion/mojo.h>
+#include <echion/sink.h>
+
+// ----------------------------------------------------------------------------
+// Serve the MOJO output to local subscribers over a Unix domain socket. The
+// socket is bound to the given path, or to a name in the abstract namespace
+// (Linux only) if the path starts with @.
+//
+// Every subscriber has its own send queue, which a server thread drains with
+// non-blocking sends, so producers never wait on a subscriber. A subscriber
+// whose queue grows past the configured limit is disconnected. New
+// subscribers are held back until the next restart, when they are sent the
+// preamble, that is the header, the metadata and all the definitions emitted
+// so far, and then join the live stream.
+class UnixSocketSink : public OutputSink
+{
+public:
+    static constexpr const char* SCHEME = "unix:";
+
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Result<void> open(const char* output) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        path = output + std::strlen(SCHEME);
+
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+            return ErrorKind::RendererError;
+
+        std::memcpy(address.sun_path, path.data(), path.size());
+        auto length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size());
+        if (path[0] == '@')
+            address.sun_path[0] = '\0';
+        else
+            ::unlink(path.c_str());
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+            return ErrorKind::RendererError;
+
+        if (!configure(listener) ||
+            bind(listener, reinterpret_cast<struct sockaddr*>(&address), length) != 0 ||
+            listen(listener, 16) != 0 || pipe(wake) != 0)
+        {
+            ::close(listener);
+            listener = -1;
+            return ErrorKind::RendererError;
+        }
+
+        configure(wake[0]);
+        configure(wake[1]);
+
+        subscribers.clear();
+        pending = false;
+        stopping = false;
+        owner = getpid();
+
+        thread = new std::thread([this]() { this->serve(); });
+
+        return Result<void>::ok();
+    }
+
+    // ------------------------------------------------------------------------
+    // Make a last attempt to send what is queued, then disconnect everyone.
+    void close() override
+    {
+        std::thread* server_thread;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            server_thread = thread;
+            thread = nullptr;
+            stopping = true;
+        }
+
+        if (server_thread == nullptr)
+            return;
+
+        notify();
+        server_thread->join();
+        delete server_thread;
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        for (auto& subscriber : subscribers)
+            ::close(subscriber->fd);
+        subscribers.clear();
+
+        ::close(listener);
+        ::close(wake[0]);
+        ::close(wake[1]);
+        listener = wake[0] = wake[1] = -1;
+
+        if (path[0] != '@')
+            ::unlink(path.c_str());
+    }
+
+    // ------------------------------------------------------------------------
+    bool write(const char* data, size_t size, RecordKind, std::string_view) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (thread == nullptr)
+            return false;
+
+        bool queued = false;
+        for (auto& subscriber : subscribers)
+        {
+            if (!subscriber->active)
+                continue;
+
+            queued |= enqueue(*subscriber, data, size);
+        }
+
+        if (queued)
+            notify();
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool needs_preamble() const override
+    {
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    // Whether there are new subscribers waiting for the preamble.
+    bool restart_due() override
+    {
+        return pending;
+    }
+
+    // ------------------------------------------------------------------------
+    void restart(const MojoBuffer& preamble) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (thread == nullptr || !pending)
+            return;
+
+        bool queued = false;
+        for (auto& subscriber : subscribers)
+        {
+            if (subscriber->active)
+                continue;
+
+            subscriber->active = true;
+            queued |= enqueue(*subscriber, preamble.data(), preamble.size());
+        }
+        pending = false;
+
+        if (queued)
+            notify();
+    }
+
+    // ------------------------------------------------------------------------
+    // Samples are never dropped for a subscriber: slow subscribers are
+    // disconnected instead.
+    size_t dropped_records() override
+    {
+        return 0;
+    }
+
+    // ------------------------------------------------------------------------
+    bool forked() const override
+    {
+        return owner != 0 && owner != getpid();
+    }
+
+private:
+    static constexpr size_t COMPACT_SIZE = 64 << 10;
+
+    struct Subscriber
+    {
+        int fd;
+        std::string queue;
+        size_t sent = 0;       // Bytes at the front of the queue already sent
+        bool active = false;   // Whether the preamble has been queued
+        bool dropped = false;  // Disconnected by a producer, for being slow
+    };
+
+    std::string path;
+    int listener = -1;
+    int wake[2] = {-1, -1};
+
+    // Subscribers are only added and removed by the server thread, so the
+    // poll descriptors it builds stay valid while it is not holding the lock.
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+
+    std::atomic<bool> pending = false;
+    std::atomic<bool> woken = false;
+    bool stopping = false;
+    pid_t owner = 0;
+
+    std::mutex lock;
+    std::thread* thread = nullptr;
+
+    // ------------------------------------------------------------------------
+    static bool configure(int fd)
+    {
+        return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0 &&
+               fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+    }
+
+    // ------------------------------------------------------------------------
+    // Returns whether the queue went from empty to non-empty.
+    bool enqueue(Subscriber& subscriber, const char* data, size_t size)
+    {
+        if (subscriber.dropped)
+            return false;
+
+        // A record always fits in an empty queue, as the preamble can be
+        // larger than the limit.
+        size_t queued = subscriber.queue.size() - subscriber.sent;
+        if (queued > 0 && queued + size > socket_queue)
+        {
+            subscriber.dropped = true;
+            subscriber.queue.clear();
+            subscriber.sent = 0;
+            return true;
+        }
+
+        subscriber.queue.append(data, size);
+
+        return queued == 0;
+    }
+
+    // ------------------------------------------------------------------------
+    // Wake the server thread up, unless it has been already.
+    void notify()
+    {
+        if (woken.exchange(true))
+            return;
+
+        char byte = 0;
+        if (::write(wake[1], &byte, 1) < 0)
+        {
+            // The pipe is full, so the server thread is awake anyway.
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Send as much of the queue as the socket takes. Returns false if the
+    // subscriber is gone.
+    static bool flush(Subscriber& subscriber)
+    {
+#ifdef MSG_NOSIGNAL
+        constexpr int flags = MSG_NOSIGNAL;
+#else
+        constexpr int flags = 0;
+#endif
+
+        while (subscriber.sent < subscriber.queue.size())
+        {
+            auto n = send(subscriber.fd, subscriber.queue.data() + subscriber.sent,
+                          subscriber.queue.size() - subscriber.sent, flags);
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    return false;
+
+                // Reclaim the space of what has been sent.
+                if (subscriber.sent >= COMPACT_SIZE)
+                {
+                    subscriber.queue.erase(0, subscriber.sent);
+                    subscriber.sent = 0;
+                }
+
+                return true;
+            }
+
+            subscriber.sent += n;
+        }
+
+        subscriber.queue.clear();
+        subscriber.sent = 0;
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    void accept_subscribers()
+    {
+        for (;;)
+        {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0)
+                return;
+
+            if (!configure(fd))
+            {
+                ::close(fd);
+                continue;
+            }
+
+#ifdef SO_NOSIGPIPE
+            int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+            subscribers.push_back(std::make_unique<Subscriber>());
+            subscribers.back()->fd = fd;
+            pending = true;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    void serve()
+    {
+        std::vector<struct pollfd> fds;
+
+        for (;;)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                fds.clear();
+                fds.push_back({listener, POLLIN, 0});
+                fds.push_back({wake[0], POLLIN, 0});
+                for (auto& subscriber : subscribers)
+                {
+                    short events = POLLIN;
+                    if (subscriber->sent < subscriber->queue.size())
+                        events |= POLLOUT;
+                    fds.push_back({subscriber->fd, events, 0});
+                }
+            }
+
+            if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+                return;
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            if (fds[1].revents & POLLIN)
+            {
+                char buffer[64];
+                woken = false;
+                while (::read(wake[0], buffer, sizeof(buffer)) > 0)
+                {
+                }
+            }
+
+            // Subscribers are not expected to send anything, so readable
+            // means disconnected, unless they are just chatty.
+            for (size_t i = 0, j = 2; i < subscribers.size(); j++)
+            {
+                auto& subscriber = *subscribers[i];
+                bool gone = subscriber.dropped;
+
+                if (!gone && (fds[j].revents & (POLLIN | POLLHUP | POLLERR)))
+                {
+                    char buffer[256];
+                    auto n = recv(subscriber.fd, buffer, sizeof(buffer), 0);
+                    gone = n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+                }
+
+                // Always try to send, so that new records go out without a
+                // round trip through poll.
+                if (!gone)
+                    gone = !flush(subscriber);
+
+                if (gone)
+                {
+                    ::close(subscriber.fd);
+                    subscribers.erase(subscribers.begin() + i);
+                    continue;
+                }
+
+                i++;
+            }
+
+            if (stopping)
+                return;
+
+            if (fds[0].revents & POLLIN)
+                accept_subscribers();
+        }
+    }
+};
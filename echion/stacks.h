@@ -7,10 +7,15 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
-#include <deque>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
 #ifndef UNWIND_NATIVE_DISABLE
 #define UNW_LOCAL_ONLY
@@ -27,64 +32,230 @@
 
 // ----------------------------------------------------------------------------
 
-class FrameStack : public std::deque<Frame::Ref>
+// A contiguous stack of frames, stored from the leaf to the root. Frames can be
+// added and removed at both ends in constant time, and whole ranges of frames
+// can be spliced in with a single copy. The storage grows geometrically and is
+// never released, so stacks that are reused across samples do not allocate
+// once they have warmed up.
+class FrameStack
 {
 public:
     using Ptr = std::unique_ptr<FrameStack>;
     using Key = Frame::Key;
+    using const_iterator = Frame* const*;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
     // ------------------------------------------------------------------------
-    Key key()
+    FrameStack(size_t capacity = 0)
     {
-        Key h = 0;
+        reserve(capacity);
+    }
 
-        for (auto it = this->begin(); it != this->end(); ++it)
-            h = rotl(h) ^ (*it).get().cache_key;
+    // ------------------------------------------------------------------------
+    FrameStack(const FrameStack& other)
+    {
+        reserve(other.size());
+        append(other);
+    }
+
+    FrameStack& operator=(const FrameStack&) = delete;
+
+    // ------------------------------------------------------------------------
+    inline size_t size() const
+    {
+        return tail - head;
+    }
+
+    inline bool empty() const
+    {
+        return tail == head;
+    }
 
-        return h;
+    inline void clear()
+    {
+        head = tail = capacity / 2;
     }
 
     // ------------------------------------------------------------------------
-    void render()
+    inline const_iterator begin() const
     {
-        for (auto it = this->rbegin(); it != this->rend(); ++it)
+        return frames.get() + head;
+    }
+
+    inline const_iterator end() const
+    {
+        return frames.get() + tail;
+    }
+
+    inline const_reverse_iterator rbegin() const
+    {
+        return const_reverse_iterator(end());
+    }
+
+    inline const_reverse_iterator rend() const
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    inline Frame& operator[](size_t i) const
+    {
+        return *frames[head + i];
+    }
+
+    inline Frame& front() const
+    {
+        return *frames[head];
+    }
+
+    inline Frame& back() const
+    {
+        return *frames[tail - 1];
+    }
+
+    // ------------------------------------------------------------------------
+    inline void push_back(Frame& frame)
+    {
+        if (tail == capacity)
+            grow(0, 1);
+
+        frames[tail++] = &frame;
+    }
+
+    inline void push_front(Frame& frame)
+    {
+        if (head == 0)
+            grow(1, 0);
+
+        frames[--head] = &frame;
+    }
+
+    // ------------------------------------------------------------------------
+    inline void pop_back(size_t n = 1)
+    {
+        tail -= std::min(n, size());
+    }
+
+    inline void pop_front(size_t n = 1)
+    {
+        head += std::min(n, size());
+    }
+
+    // ------------------------------------------------------------------------
+    // Copy the first n frames of the other stack at the front of this one.
+    inline void prepend(const FrameStack& other, size_t n)
+    {
+        n = std::min(n, other.size());
+        if (head < n)
+            grow(n, 0);
+
+        head -= n;
+        std::memcpy(&frames[head], other.begin(), n * sizeof(Frame*));
+    }
+
+    // Copy all the frames of the other stack at the back of this one.
+    inline void append(const FrameStack& other)
+    {
+        size_t n = other.size();
+        if (capacity - tail < n)
+            grow(0, n);
+
+        std::memcpy(&frames[tail], other.begin(), n * sizeof(Frame*));
+        tail += n;
+    }
+
+    // ------------------------------------------------------------------------
+    // A position-dependent 64-bit hash of the frames that would be rendered.
+    // Each step goes through a full 64x64->128 multiply, so permutations and
+    // repeated frames do not cancel out like they would with a plain fold.
+    Key key() const
+    {
+        uint64_t h = 0x243f6a8885a308d3;
+        size_t n = 0;
+
+        for (auto it = this->begin(); it != this->end(); ++it)
         {
-#if PY_VERSION_HEX >= 0x030c0000
-            if ((*it).get().is_entry)
-                // This is a shim frame so we skip it.
+            if (!is_rendered(**it))
                 continue;
-#endif
-            Renderer::get().render_frame((*it).get());
+
+            h = hash_mix(h ^ 0xa0761d6478bd642f, (*it)->cache_key ^ 0xe7037ed1a0b428db);
+            n++;
         }
+
+        return hash_mix(h ^ 0x8ebc6af09c88c6e3, n ^ 0x589965cc75374cc3);
     }
 
+    // ------------------------------------------------------------------------
+    // Fill in the frames of a sample with this stack. The view remains valid
+    // until the next call on the same thread.
+    inline void view(SampleView& sample);
+
     // ------------------------------------------------------------------------
     void render_where()
     {
         for (auto it = this->rbegin(); it != this->rend(); ++it)
         {
+            if (is_rendered(**it))
+                WhereRenderer::get().render_frame(**it);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    static inline bool is_rendered(const Frame& frame)
+    {
 #if PY_VERSION_HEX >= 0x030c0000
-            if ((*it).get().is_entry)
-                // This is a shim frame so we skip it.
-                continue;
+        // Shim frames are never rendered.
+        return !frame.is_entry;
+#else
+        (void)frame;
+        return true;
 #endif
-            WhereRenderer::get().render_frame((*it).get());
-        }
     }
 
 private:
+    std::unique_ptr<Frame*[]> frames = nullptr;
+    size_t capacity = 0;
+    size_t head = 0;
+    size_t tail = 0;
+
     // ------------------------------------------------------------------------
-    static inline Frame::Key rotl(Key key)
+    inline void reserve(size_t n)
     {
-        return (key << 1) | (key >> (CHAR_BIT * sizeof(key) - 1));
+        // Leave the same amount of room at both ends.
+        capacity = std::max<size_t>(2 * n, 64);
+        frames = std::make_unique<Frame*[]>(capacity);
+        clear();
+    }
+
+    // ------------------------------------------------------------------------
+    // Make room for at least the requested number of frames at either end.
+    void grow(size_t front, size_t back)
+    {
+        size_t n = size();
+        size_t new_capacity = std::max(2 * capacity, n + front + back);
+        size_t new_head = front + (new_capacity - n - front - back) / 2;
+
+        auto new_frames = std::make_unique<Frame*[]>(new_capacity);
+        std::memcpy(&new_frames[new_head], begin(), n * sizeof(Frame*));
+
+        frames = std::move(new_frames);
+        capacity = new_capacity;
+        head = new_head;
+        tail = new_head + n;
+    }
+
+    // ------------------------------------------------------------------------
+    static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+    {
+        auto r = static_cast<unsigned __int128>(a) * b;
+        return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
     }
 };
 
 // ----------------------------------------------------------------------------
 
-inline FrameStack python_stack;
-inline FrameStack native_stack;
-inline FrameStack interleaved_stack;
+inline FrameStack python_stack(max_frames);
+inline FrameStack native_stack(max_frames);
+inline FrameStack interleaved_stack(2 * max_frames);
 
 // ----------------------------------------------------------------------------
 #ifndef UNWIND_NATIVE_DISABLE
@@ -111,20 +282,46 @@ inline void unwind_native_stack()
 }
 #endif  // UNWIND_NATIVE_DISABLE
 
+// ----------------------------------------------------------------------------
+// Brent's cycle detection over a chain of frames. Corrupted reads can make the
+// chain loop back on itself, and this catches it within a few multiples of the
+// cycle length without having to remember every frame we have visited.
+class FrameCycleDetector
+{
+public:
+    inline bool seen(PyObject* frame)
+    {
+        if (frame == tortoise)
+            return true;
+
+        if (++steps == power)
+        {
+            tortoise = frame;
+            power <<= 1;
+            steps = 0;
+        }
+
+        return false;
+    }
+
+private:
+    PyObject* tortoise = NULL;
+    size_t power = 1;
+    size_t steps = 0;
+};
+
 // ----------------------------------------------------------------------------
 static size_t unwind_frame(PyObject* frame_addr, FrameStack& stack)
 {
-    std::unordered_set<PyObject*> seen_frames;  // Used to detect cycles in the stack
+    FrameCycleDetector cycle;
     int count = 0;
 
     PyObject* current_frame_addr = frame_addr;
     while (current_frame_addr != NULL && stack.size() < max_frames)
     {
-        if (seen_frames.find(current_frame_addr) != seen_frames.end())
+        if (cycle.seen(current_frame_addr))
             break;
 
-        seen_frames.insert(current_frame_addr);
-
 #if PY_VERSION_HEX >= 0x030b0000
         auto maybe_frame =
             Frame::read(reinterpret_cast<_PyInterpreterFrame*>(current_frame_addr),
@@ -151,13 +348,13 @@ static size_t unwind_frame(PyObject* frame_addr, FrameStack& stack)
 // ----------------------------------------------------------------------------
 static size_t unwind_frame_unsafe(PyObject* frame, FrameStack& stack)
 {
-    std::unordered_set<PyObject*> seen_frames;  // Used to detect cycles in the stack
+    FrameCycleDetector cycle;
     int count = 0;
 
     PyObject* current_frame = frame;
     while (current_frame != NULL && stack.size() < max_frames)
     {
-        if (seen_frames.find(current_frame) != seen_frames.end())
+        if (cycle.seen(current_frame))
             break;
 
 #if PY_VERSION_HEX >= 0x030d0000
@@ -178,8 +375,6 @@ static size_t unwind_frame_unsafe(PyObject* frame, FrameStack& stack)
 #endif  // PY_VERSION_HEX >= 0x030d0000
         count++;
 
-        seen_frames.insert(current_frame);
-
         stack.push_back(Frame::get(current_frame));
 
 #if PY_VERSION_HEX >= 0x030b0000
@@ -266,9 +461,9 @@ static Result<void> interleave_stacks(FrameStack& python_stack)
     // handler. We skip them.
     for (auto n = native_stack.rbegin(); n != native_stack.rend() - 2; ++n)
     {
-        auto native_frame = *n;
+        auto& native_frame = **n;
 
-        auto maybe_name = string_table.lookup(native_frame.get().name);
+        auto maybe_name = string_table.lookup(native_frame.name);
         if (!maybe_name)
         {
             return ErrorKind::LookupError;
@@ -294,14 +489,14 @@ static Result<void> interleave_stacks(FrameStack& python_stack)
                 {
                     // The Python stack will start with an entry frame at the top.
                     // We stop popping at the next entry frame.
-                    cframe_count += (*p).get().is_entry;
+                    cframe_count += (*p)->is_entry;
                     if (cframe_count >= 2)
                         break;
 
-                    interleaved_stack.push_front(*p++);
+                    interleaved_stack.push_front(**p++);
                 }
 #else
-                interleaved_stack.push_front(*p++);
+                interleaved_stack.push_front(**p++);
 #endif
             }
         }
@@ -313,7 +508,7 @@ static Result<void> interleave_stacks(FrameStack& python_stack)
     {
         std::cerr << "Python stack not empty after interleaving!" << std::endl;
         while (p != python_stack.rend())
-            interleaved_stack.push_front(*p++);
+            interleaved_stack.push_front(**p++);
     }
 
     return Result<void>::ok();
@@ -336,38 +531,139 @@ public:
     StackInfo(StringTable::Key task_name, bool on_cpu) : task_name(task_name), on_cpu(on_cpu) {}
 };
 
+// ----------------------------------------------------------------------------
+// A list of stack infos that keeps hold of its items when cleared, so that the
+// frame stacks they own can be reused by the next sample instead of being
+// allocated afresh.
+class StackInfoList
+{
+public:
+    using iterator = std::vector<std::unique_ptr<StackInfo>>::iterator;
+
+    // ------------------------------------------------------------------------
+    StackInfo& emplace_back(StringTable::Key task_name, bool on_cpu)
+    {
+        if (count == items.size())
+            items.push_back(std::make_unique<StackInfo>(task_name, on_cpu));
+
+        auto& stack_info = *items[count++];
+        stack_info.task_name = task_name;
+        stack_info.on_cpu = on_cpu;
+        stack_info.stack.clear();
+
+        return stack_info;
+    }
+
+    // ------------------------------------------------------------------------
+    inline iterator begin()
+    {
+        return items.begin();
+    }
+
+    inline iterator end()
+    {
+        return items.begin() + count;
+    }
+
+    inline size_t size() const
+    {
+        return count;
+    }
+
+    inline bool empty() const
+    {
+        return count == 0;
+    }
+
+    inline void clear()
+    {
+        count = 0;
+    }
+
+private:
+    std::vector<std::unique_ptr<StackInfo>> items;
+    size_t count = 0;
+};
+
 // ----------------------------------------------------------------------------
 // This table is used to store entire stacks and index them by key. This is
 // used when profiling memory events to account for deallocations.
+//
+// Stacks are interned: the keys of their rendered frames are copied into an
+// arena the first time they are seen, and every stack gets a dense, sequential
+// key. Lookups go through the stack hash, but the frames are always compared
+// in full, so two different stacks can never share a key, even if their hashes
+// collide.
 class StackTable
 {
 public:
     // ------------------------------------------------------------------------
-    FrameStack::Key inline store(FrameStack::Ptr stack)
+    // The stack is only copied the first time it is seen, so callers can
+    // unwind into a reusable buffer.
+    FrameStack::Key inline store(const FrameStack& stack)
     {
+        auto hash = stack.key();
+
         std::lock_guard<std::mutex> lock(this->lock);
 
-        auto stack_key = stack->key();
+        auto head = buckets.find(hash);
+        if (head != buckets.end())
+        {
+            for (auto index = head->second; index != NO_ENTRY; index = entries[index].next)
+            {
+                if (matches(entries[index], stack))
+                    return index + 1;
+            }
+        }
 
-        auto stack_entry = table.find(stack_key);
-        if (stack_entry == table.end())
+        auto size = count_rendered(stack);
+        auto* frames = allocate(size);
+        for (auto* frame : stack)
         {
-            table.emplace(stack_key, std::move(stack));
+            if (FrameStack::is_rendered(*frame))
+                *frames++ = frame->cache_key;
         }
-        else
+
+        auto index = static_cast<uint32_t>(entries.size());
+        entries.push_back({frames - size, static_cast<uint32_t>(size),
+                           head != buckets.end() ? head->second : NO_ENTRY});
+        buckets[hash] = index;
+
+        if (stack_refs)
+            Renderer::get().stack_def(index + 1, frames - size, size);
+
+        return index + 1;
+    }
+
+    // ------------------------------------------------------------------------
+    // Fill in the frames of a sample with a stored stack.
+    void view(FrameStack::Key stack_key, SampleView& sample)
+    {
+        if (stack_refs)
         {
-            // TODO: Check for collisions.
+            // The stack was defined when it was stored.
+            sample.stack_key = stack_key;
+            return;
         }
 
-        return stack_key;
+        std::lock_guard<std::mutex> lock(this->lock);
+
+        if (stack_key == 0 || stack_key > entries.size())
+            return;
+
+        // The arena never moves or frees its frames until the table is
+        // cleared, so the view can be rendered without holding the lock.
+        auto& entry = entries[stack_key - 1];
+        sample.frames = entry.frames;
+        sample.frame_count = entry.size;
     }
 
     // ------------------------------------------------------------------------
-    FrameStack& retrieve(FrameStack::Key stack_key)
+    size_t size()
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
-        return *table.find(stack_key)->second;
+        return entries.size();
     }
 
     // ------------------------------------------------------------------------
@@ -375,12 +671,72 @@ public:
     {
         std::lock_guard<std::mutex> lock(this->lock);
 
-        table.clear();
+        buckets.clear();
+        entries.clear();
+        chunks.clear();
+        chunk_used = chunk_size = 0;
     }
 
 private:
-    std::unordered_map<FrameStack::Key, std::unique_ptr<FrameStack>> table;
+    static constexpr uint32_t NO_ENTRY = UINT32_MAX;
+    static constexpr size_t CHUNK_FRAMES = 1 << 16;
+
+    struct Entry
+    {
+        const mojo_ref_t* frames;
+        uint32_t size;
+        uint32_t next;  // Next entry with the same hash
+    };
+
+    std::unordered_map<FrameStack::Key, uint32_t> buckets;
+    std::vector<Entry> entries;
+
+    std::vector<std::unique_ptr<mojo_ref_t[]>> chunks;
+    size_t chunk_used = 0;
+    size_t chunk_size = 0;
+
     std::mutex lock;
+
+    // ------------------------------------------------------------------------
+    static inline size_t count_rendered(const FrameStack& stack)
+    {
+        return std::count_if(stack.begin(), stack.end(),
+                             [](const Frame* frame) { return FrameStack::is_rendered(*frame); });
+    }
+
+    // ------------------------------------------------------------------------
+    static inline bool matches(const Entry& entry, const FrameStack& stack)
+    {
+        size_t i = 0;
+        for (auto* frame : stack)
+        {
+            if (!FrameStack::is_rendered(*frame))
+                continue;
+
+            if (i == entry.size || entry.frames[i] != frame->cache_key)
+                return false;
+
+            i++;
+        }
+
+        return i == entry.size;
+    }
+
+    // ------------------------------------------------------------------------
+    mojo_ref_t* allocate(size_t size)
+    {
+        if (chunks.empty() || chunk_size - chunk_used < size)
+        {
+            chunk_size = std::max(size, CHUNK_FRAMES);
+            chunks.push_back(std::make_unique<mojo_ref_t[]>(chunk_size));
+            chunk_used = 0;
+        }
+
+        auto* frames = chunks.back().get() + chunk_used;
+        chunk_used += size;
+
+        return frames;
+    }
 };
 
 // ----------------------------------------------------------------------------
@@ -388,3 +744,25 @@ private:
 // the destruction on exit. We are in charge of cleaning up the object. Note
 // that the object will leak, but this is not a problem.
 inline auto& stack_table = *(new StackTable());
+
+// ----------------------------------------------------------------------------
+inline void FrameStack::view(SampleView& sample)
+{
+    if (stack_refs)
+    {
+        // Refer to the interned stack instead of writing out all of its frames.
+        sample.stack_key = stack_table.store(*this);
+        return;
+    }
+
+    static thread_local std::vector<mojo_ref_t> keys;
+    keys.clear();
+    for (auto* frame : *this)
+    {
+        if (is_rendered(*frame))
+            keys.push_back(frame->cache_key);
+    }
+
+    sample.frames = keys.data();
+    sample.frame_count = keys.size();
+}
@@ -8,8 +8,15 @@
 #include <Python.h>
 #include <unicodeobject.h>
 
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #ifndef UNWIND_NATIVE_DISABLE
 #include <cxxabi.h>
@@ -18,6 +25,7 @@
 #endif  // UNWIND_NATIVE_DISABLE
 
 
+#include <echion/config.h>
 #include <echion/long.h>
 #include <echion/render.h>
 #include <echion/vm.h>
@@ -74,7 +82,16 @@ static Result<std::string> pyunicode_to_utf8(PyObject* str_addr)
 
 // ----------------------------------------------------------------------------
 
-class StringTable : public std::unordered_map<uintptr_t, std::string>
+// The string table is read on every sample (frame and task names) and written
+// only when a new string is first seen. Lookups and hits on existing keys are
+// therefore lock-free: the index is an open-addressing table of immutable
+// entries that is published atomically, and rebuilt (copy-on-grow) by writers,
+// which serialise on the table lock. Retired entries and indices are kept
+// alive until the following clear, so that concurrent readers never observe
+// freed memory. Strings are defined in the output before their entries are
+// published, so that readers never refer to a string that is yet to be
+// defined.
+class StringTable
 {
 public:
     using Key = uintptr_t;
@@ -87,55 +104,85 @@ public:
     // Python string object
     [[nodiscard]] inline Result<Key> key(PyObject* s)
     {
-        const std::lock_guard<std::mutex> lock(table_lock);
-
         auto k = reinterpret_cast<Key>(s);
 
-        if (this->find(k) == this->end())
-        {
-#if PY_VERSION_HEX >= 0x030c0000
-            // The task name might hold a PyLong for deferred task name formatting.
-            std::string str = "Task-";
+        if (auto* entry = find(k))
+            return Result<Key>(entry->key);
 
-            auto maybe_long = pylong_to_llong(s);
-            if (maybe_long)
-            {
-                str += std::to_string(*maybe_long);
-            }
-            else
-            {
-                auto maybe_unicode = pyunicode_to_utf8(s);
-                if (!maybe_unicode)
-                {
-                    return ErrorKind::PyUnicodeError;
-                }
+        const std::lock_guard<std::mutex> lock(table_lock);
 
-                str = *maybe_unicode;
-            }
-#else
-            auto maybe_unicode = pyunicode_to_utf8(s);
-            if (!maybe_unicode)
-            {
-                return ErrorKind::PyUnicodeError;
-            }
+        if (auto* entry = find(k))
+            return Result<Key>(entry->key);
 
-            std::string str = std::move(*maybe_unicode);
-#endif
-            this->emplace(k, str);
-            Renderer::get().string(k, str);
+        auto maybe_str = read(s);
+        if (!maybe_str)
+        {
+            return ErrorKind::PyUnicodeError;
         }
 
+        Renderer::get().string(k, *maybe_str);
+        insert(k, *maybe_str);
+
         return Result<Key>(k);
     };
 
-    // Python string object
-    [[nodiscard]] inline Key key_unsafe(PyObject* s)
+    // Task name object. Depending on the task name mode, names that only differ
+    // by a numeric suffix (e.g. the default "Task-<n>") are folded onto a
+    // single entry, so that task churn does not produce a new string (and task
+    // frame) for every task. Folded entries are keyed by the address of their
+    // own storage, which cannot clash with that of any live object.
+    [[nodiscard]] inline Result<Key> task_key(PyObject* s)
     {
+        if (task_names != TASK_NAMES_FOLD)
+            return key(s);
+
+        auto k = reinterpret_cast<Key>(s);
+
+        if (auto* entry = find(k))
+            return Result<Key>(entry->key);
+
         const std::lock_guard<std::mutex> lock(table_lock);
 
+        if (auto* entry = find(k))
+            return Result<Key>(entry->key);
+
+        auto maybe_str = read(s);
+        if (!maybe_str)
+        {
+            return ErrorKind::PyUnicodeError;
+        }
+
+        auto folded_name = fold(*maybe_str);
+
+        auto folded_entry = folded.find(folded_name);
+        if (folded_entry == folded.end())
+        {
+            auto* entry = make_entry(folded_name);
+            Renderer::get().string(entry->key, entry->value);
+            grow();
+            place(*index.load(std::memory_order_relaxed), entry->key, entry);
+            folded_entry = folded.emplace(std::move(folded_name), entry).first;
+        }
+
+        // Alias the task name object to the folded entry
+        auto* entry = folded_entry->second;
+        grow();
+        place(*index.load(std::memory_order_relaxed), k, entry);
+
+        return Result<Key>(entry->key);
+    }
+
+    // Python string object
+    [[nodiscard]] inline Key key_unsafe(PyObject* s)
+    {
         auto k = reinterpret_cast<Key>(s);
 
-        if (this->find(k) == this->end())
+        if (auto* entry = find(k))
+            return entry->key;
+
+        const std::lock_guard<std::mutex> lock(table_lock);
+
+        if (find(k) == nullptr)
         {
 #if PY_VERSION_HEX >= 0x030c0000
             // The task name might hold a PyLong for deferred task name formatting.
@@ -144,8 +191,8 @@ public:
 #else
             auto str = std::string(PyUnicode_AsUTF8(s));
 #endif
-            this->emplace(k, str);
             Renderer::get().string(k, str);
+            insert(k, str);
         }
 
         return k;
@@ -155,16 +202,19 @@ public:
     // Native filename by program counter
     [[nodiscard]] inline Key key(unw_word_t pc)
     {
-        const std::lock_guard<std::mutex> lock(table_lock);
-
         auto k = static_cast<Key>(pc);
 
-        if (this->find(k) == this->end())
+        if (auto* entry = find(k))
+            return entry->key;
+
+        const std::lock_guard<std::mutex> lock(table_lock);
+
+        if (find(k) == nullptr)
         {
             char buffer[32] = {0};
             std::snprintf(buffer, 32, "native@%p", reinterpret_cast<void*>(k));
-            this->emplace(k, buffer);
             Renderer::get().string(k, buffer);
+            insert(k, buffer);
         }
 
         return k;
@@ -173,15 +223,18 @@ public:
     // Native scope name by unwinding cursor
     [[nodiscard]] inline Result<Key> key(unw_cursor_t& cursor)
     {
-        const std::lock_guard<std::mutex> lock(table_lock);
-
         unw_proc_info_t pi;
         if ((unw_get_proc_info(&cursor, &pi)))
             return ErrorKind::UnwindError;
 
         auto k = reinterpret_cast<Key>(pi.start_ip);
 
-        if (this->find(k) == this->end())
+        if (auto* entry = find(k))
+            return Result<Key>(entry->key);
+
+        const std::lock_guard<std::mutex> lock(table_lock);
+
+        if (find(k) == nullptr)
         {
             unw_word_t offset;  // Ignored. All the information is in the PC anyway.
             char sym[256];
@@ -200,8 +253,8 @@ public:
                     name = demangled;
             }
 
-            this->emplace(k, name);
             Renderer::get().string(k, name);
+            insert(k, name);
 
             if (demangled)
                 std::free(demangled);
@@ -213,24 +266,213 @@ public:
 
     [[nodiscard]] inline Result<std::reference_wrapper<std::string>> lookup(Key key)
     {
-        const std::lock_guard<std::mutex> lock(table_lock);
-
-        auto it = this->find(key);
-        if (it == this->end())
+        auto* entry = find(key);
+        if (entry == nullptr)
             return ErrorKind::LookupError;
 
-        return std::ref(it->second);
+        return std::ref(entry->value);
     };
 
-    StringTable() : std::unordered_map<uintptr_t, std::string>()
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        const std::lock_guard<std::mutex> lock(table_lock);
+
+        // Anything retired by the previous clear can no longer be referenced.
+        retired_entries.clear();
+        retired_indices.clear();
+
+        std::move(entries.begin(), entries.end(), std::back_inserter(retired_entries));
+        std::move(indices.begin(), indices.end(), std::back_inserter(retired_indices));
+        entries.clear();
+        indices.clear();
+        folded.clear();
+
+        reset();
+    }
+
+    StringTable()
     {
-        this->emplace(0, "");
-        this->emplace(INVALID, "<invalid>");
-        this->emplace(UNKNOWN, "<unknown>");
+        reset();
     };
 
 private:
+    struct Entry
+    {
+        Key key;
+        std::string value;
+
+        Entry(Key key, std::string value) : key(key), value(std::move(value)) {}
+    };
+
+    // A slot is written once: the key is set before the entry is published, so
+    // a reader that observes a non-null entry also observes its key. Aliases
+    // (see task_key) are slots whose key differs from that of their entry.
+    struct Slot
+    {
+        Key key;
+        std::atomic<Entry*> entry;
+    };
+
+    struct Index
+    {
+        size_t capacity;
+        size_t size = 0;
+        unsigned int shift;
+        std::unique_ptr<Slot[]> slots;
+
+        Index(unsigned int bits)
+            : capacity(size_t(1) << bits), shift(64 - bits), slots(new Slot[capacity]())
+        {
+        }
+
+        inline size_t slot(Key key) const
+        {
+            // Fibonacci hashing spreads the aligned pointer keys across the table.
+            return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ULL) >>
+                                       shift);
+        }
+    };
+
+    static constexpr unsigned int INITIAL_INDEX_BITS = 12;
+
+    std::atomic<Index*> index = nullptr;
+
+    // Owned storage. Only modified with the table lock held.
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::vector<std::unique_ptr<Index>> indices;
+    std::vector<std::unique_ptr<Entry>> retired_entries;
+    std::vector<std::unique_ptr<Index>> retired_indices;
+    std::unordered_map<std::string, Entry*> folded;
+
     std::mutex table_lock;
+
+    // ------------------------------------------------------------------------
+    inline Entry* find(Key key) const
+    {
+        auto* current = index.load(std::memory_order_acquire);
+        const size_t mask = current->capacity - 1;
+
+        for (size_t i = current->slot(key);; i = (i + 1) & mask)
+        {
+            auto* entry = current->slots[i].entry.load(std::memory_order_acquire);
+            if (entry == nullptr)
+                return nullptr;
+
+            if (current->slots[i].key == key)
+                return entry;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    static inline void place(Index& target, Key key, Entry* entry)
+    {
+        const size_t mask = target.capacity - 1;
+
+        size_t i = target.slot(key);
+        while (target.slots[i].entry.load(std::memory_order_relaxed) != nullptr)
+            i = (i + 1) & mask;
+
+        target.slots[i].key = key;
+        target.slots[i].entry.store(entry, std::memory_order_release);
+        target.size++;
+    }
+
+    // ------------------------------------------------------------------------
+    static Result<std::string> read(PyObject* s)
+    {
+#if PY_VERSION_HEX >= 0x030c0000
+        // The task name might hold a PyLong for deferred task name formatting.
+        auto maybe_long = pylong_to_llong(s);
+        if (maybe_long)
+        {
+            return "Task-" + std::to_string(*maybe_long);
+        }
+#endif
+        return pyunicode_to_utf8(s);
+    }
+
+    // ------------------------------------------------------------------------
+    // Strip any trailing separator-delimited numeric suffixes, e.g. "Task-42"
+    // becomes "Task" and "worker_3-1" becomes "worker".
+    static std::string fold(const std::string& name)
+    {
+        auto end = name.size();
+
+        for (;;)
+        {
+            auto digits = name.find_last_not_of("0123456789", end - 1);
+            if (digits == std::string::npos || digits == end - 1 || digits == 0)
+                break;
+
+            if (std::strchr("-_.:# ", name[digits]) == nullptr)
+                break;
+
+            end = digits;
+        }
+
+        return name.substr(0, end);
+    }
+
+    // ------------------------------------------------------------------------
+    // Requires the table lock.
+    void insert(Key key, std::string value)
+    {
+        grow();
+
+        entries.push_back(std::make_unique<Entry>(key, std::move(value)));
+        place(*index.load(std::memory_order_relaxed), key, entries.back().get());
+    }
+
+    // ------------------------------------------------------------------------
+    // Make an entry keyed by its own address, which is yet to be placed in the
+    // index. Requires the table lock.
+    Entry* make_entry(std::string value)
+    {
+        entries.push_back(std::make_unique<Entry>(0, std::move(value)));
+
+        auto* entry = entries.back().get();
+        entry->key = reinterpret_cast<Key>(entry);
+
+        return entry;
+    }
+
+    // ------------------------------------------------------------------------
+    // Make room for one more slot. Requires the table lock.
+    void grow()
+    {
+        auto* current = index.load(std::memory_order_relaxed);
+
+        // Keep the load factor below 1/2 so that probe sequences stay short.
+        if ((current->size + 1) * 2 > current->capacity)
+        {
+            unsigned int bits = 64 - current->shift + 1;
+            auto grown = std::make_unique<Index>(bits);
+
+            for (size_t i = 0; i < current->capacity; i++)
+            {
+                auto* entry = current->slots[i].entry.load(std::memory_order_relaxed);
+                if (entry != nullptr)
+                    place(*grown, current->slots[i].key, entry);
+            }
+
+            // Readers may still be probing the old index, so we keep it around.
+            index.store(grown.get(), std::memory_order_release);
+            indices.push_back(std::move(grown));
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Requires the table lock.
+    void reset()
+    {
+        indices.push_back(std::make_unique<Index>(INITIAL_INDEX_BITS));
+        index.store(indices.back().get(), std::memory_order_release);
+
+        insert(0, "");
+        insert(INVALID, "<invalid>");
+        insert(UNKNOWN, "<unknown>");
+    }
 };
 
 // We make this a reference to a heap-allocated object so that we can avoid
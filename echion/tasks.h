@@ -24,8 +24,8 @@
 #include <opcode.h>
 #endif  // PY_VERSION_HEX >= 0x30b0000
 
+#include <array>
 #include <mutex>
-#include <stack>
 #include <unordered_map>
 #include <vector>
 
@@ -74,6 +74,7 @@ public:
 
     PyObject* origin = nullptr;
     PyObject* frame = nullptr;
+    PyObject* qualname = nullptr;
 
     // The coroutine awaited by this coroutine, if any
     GenInfo::Ptr await = nullptr;
@@ -82,8 +83,13 @@ public:
     bool is_running = false;
 
     [[nodiscard]] static Result<GenInfo::Ptr> create(PyObject* gen_addr);
-    GenInfo(PyObject* origin, PyObject* frame, GenInfo::Ptr await, bool is_running)
-        : origin(origin), frame(frame), await(std::move(await)), is_running(is_running)
+    GenInfo(PyObject* origin, PyObject* frame, PyObject* qualname, GenInfo::Ptr await,
+            bool is_running)
+        : origin(origin),
+          frame(frame),
+          qualname(qualname),
+          await(std::move(await)),
+          is_running(is_running)
     {
     }
 };
@@ -172,7 +178,8 @@ inline Result<GenInfo::Ptr> GenInfo::create(PyObject* gen_addr)
     }
 
     recursion_depth--;
-    return std::make_unique<GenInfo>(gen_addr, frame, std::move(await), is_running);
+    return std::make_unique<GenInfo>(gen_addr, frame, gen.gi_qualname, std::move(await),
+                                     is_running);
 }
 
 // ----------------------------------------------------------------------------
@@ -234,7 +241,10 @@ inline Result<TaskInfo::Ptr> TaskInfo::create(TaskObj* task_addr)
         return ErrorKind::TaskInfoGeneratorError;
     }
 
-    auto maybe_name = string_table.key(task.task_name);
+    auto& coro = *maybe_coro;
+    auto maybe_name = (task_names == TASK_NAMES_CORO && coro->qualname != NULL)
+                          ? string_table.key(coro->qualname)
+                          : string_table.task_key(task.task_name);
     if (!maybe_name)
     {
         recursion_depth--;
@@ -356,32 +366,31 @@ inline Result<TaskInfo::Ptr> TaskInfo::current(PyObject* loop)
 
 // ----------------------------------------------------------------------------
 
-inline std::vector<std::unique_ptr<StackInfo>> current_tasks;
+inline StackInfoList current_tasks;
 
 // ----------------------------------------------------------------------------
 
 inline size_t TaskInfo::unwind(FrameStack& stack)
 {
     // TODO: Check for running task.
-    std::stack<PyObject*> coro_frames;
+    // The await chain is bounded by the recursion depth we allow when
+    // reading it, so a fixed array is enough to hold its frames.
+    std::array<PyObject*, MAX_RECURSION_DEPTH + 1> coro_frames;
+    size_t depth = 0;
 
     // Unwind the coro chain
-    for (auto coro = this->coro.get(); coro != NULL; coro = coro->await.get())
+    for (auto coro = this->coro.get(); coro != NULL && depth < coro_frames.size();
+         coro = coro->await.get())
     {
         if (coro->frame != NULL)
-            coro_frames.push(coro->frame);
+            coro_frames[depth++] = coro->frame;
     }
 
     int count = 0;
 
     // Unwind the coro frames
-    while (!coro_frames.empty())
-    {
-        PyObject* frame = coro_frames.top();
-        coro_frames.pop();
-
-        count += unwind_frame(frame, stack);
-    }
+    while (depth > 0)
+        count += unwind_frame(coro_frames[--depth], stack);
 
     return count;
 }
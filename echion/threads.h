@@ -292,8 +292,8 @@ inline Result<void> ThreadInfo::unwind_tasks()
 
     for (auto& leaf_task : leaf_tasks)
     {
-        auto stack_info = std::make_unique<StackInfo>(leaf_task.get().name, leaf_task.get().is_on_cpu);
-        auto& stack = stack_info->stack;
+        auto& stack_info = current_tasks.emplace_back(leaf_task.get().name, leaf_task.get().is_on_cpu);
+        auto& stack = stack_info.stack;
         for (auto current_task = leaf_task;;)
         {
             auto& task = current_task.get();
@@ -303,25 +303,13 @@ inline Result<void> ThreadInfo::unwind_tasks()
             if (task.is_on_cpu)
             {
                 // Undo the stack unwinding
-                // TODO[perf]: not super-efficient :(
-                for (size_t i = 0; i < stack_size; i++)
-                    stack.pop_back();
+                stack.pop_back(stack_size);
 
                 // Instead we get part of the thread stack
-                FrameStack temp_stack;
                 size_t nframes =
                     (python_stack.size() > stack_size) ? python_stack.size() - stack_size : 0;
-                for (size_t i = 0; i < nframes; i++)
-                {
-                    auto python_frame = python_stack.front();
-                    temp_stack.push_front(python_frame);
-                    python_stack.pop_front();
-                }
-                while (!temp_stack.empty())
-                {
-                    stack.push_front(temp_stack.front());
-                    temp_stack.pop_front();
-                }
+                stack.prepend(python_stack, nframes);
+                python_stack.pop_front(nframes);
             }
 
             // Add the task name frame
@@ -351,10 +339,7 @@ inline Result<void> ThreadInfo::unwind_tasks()
         }
 
         // Finish off with the remaining thread stack
-        for (auto p = python_stack.begin(); p != python_stack.end(); p++)
-            stack.push_back(*p);
-
-        current_tasks.push_back(std::move(stack_info));
+        stack.append(python_stack);
     }
 
     return Result<void>::ok();
@@ -401,8 +386,7 @@ inline void ThreadInfo::unwind_greenlets(PyThreadState* tstate, unsigned long na
             continue;
         }
 
-        auto stack_info = std::make_unique<StackInfo>(greenlet->name, on_cpu);
-        auto& stack = stack_info->stack;
+        auto& stack = current_greenlets.emplace_back(greenlet->name, on_cpu).stack;
 
         greenlet->unwind(frame, tstate, stack);
 
@@ -428,8 +412,6 @@ inline void ThreadInfo::unwind_greenlets(PyThreadState* tstate, unsigned long na
             // Move up the greenlet chain
             greenlet_id = parent_greenlet_id;
         }
-
-        current_greenlets.push_back(std::move(stack_info));
     }
 }
 
@@ -438,6 +420,12 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
 {
     Renderer::get().render_thread_begin(tstate, name, delta, thread_id, native_id);
 
+    SampleView sample;
+    sample.pid = pid;
+    sample.iid = iid;
+    sample.thread_name = &name;
+    sample.delta = delta;
+
     if (cpu)
     {
         microsecond_t previous_cpu_time = cpu_time;
@@ -453,7 +441,7 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
             return Result<void>::ok();
         }
 
-        Renderer::get().render_cpu_time(running ? cpu_time - previous_cpu_time : 0);
+        sample.cpu_time = running ? cpu_time - previous_cpu_time : 0;
     }
 
     this->unwind(tstate);
@@ -472,9 +460,8 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
                 return ErrorKind::ThreadInfoError;
             }
 
-            const auto& task_name = maybe_task_name->get();
-            Renderer::get().render_task_begin(task_name, task_stack_info->on_cpu);
-            Renderer::get().render_stack_begin(pid, iid, name);
+            sample.task_name = &maybe_task_name->get();
+            sample.on_cpu = task_stack_info->on_cpu;
             if (native)
             {
                 // NOTE: These stacks might be non-sensical, especially with
@@ -484,12 +471,12 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
                     return ErrorKind::ThreadInfoError;
                 }
 
-                interleaved_stack.render();
+                interleaved_stack.view(sample);
             }
             else
-                task_stack_info->stack.render();
+                task_stack_info->stack.view(sample);
 
-            Renderer::get().render_stack_end(MetricType::Time, delta);
+            Renderer::get().render_sample(sample);
         }
 
         current_tasks.clear();
@@ -503,9 +490,8 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
                 return ErrorKind::ThreadInfoError;
             }
 
-            const auto& task_name = maybe_task_name->get();
-            Renderer::get().render_task_begin(task_name, greenlet_stack->on_cpu);
-            Renderer::get().render_stack_begin(pid, iid, name);
+            sample.task_name = &maybe_task_name->get();
+            sample.on_cpu = greenlet_stack->on_cpu;
 
             auto& stack = greenlet_stack->stack;
             if (native)
@@ -517,12 +503,12 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
                     return ErrorKind::ThreadInfoError;
                 }
 
-                interleaved_stack.render();
+                interleaved_stack.view(sample);
             }
             else
-                stack.render();
+                stack.view(sample);
 
-            Renderer::get().render_stack_end(MetricType::Time, delta);
+            Renderer::get().render_sample(sample);
         }
 
         current_greenlets.clear();
@@ -533,9 +519,6 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
         // so if we don't skip here we would have a double print.
         if (current_greenlets.empty())
         {
-            // Print the PID and thread name
-            Renderer::get().render_stack_begin(pid, iid, name);
-            // Print the stack
             if (native)
             {
                 if (!interleave_stacks())
@@ -543,12 +526,12 @@ inline Result<void> ThreadInfo::sample(int64_t iid, PyThreadState* tstate, micro
                     return ErrorKind::ThreadInfoError;
                 }
 
-                interleaved_stack.render();
+                interleaved_stack.view(sample);
             }
             else
-                python_stack.render();
+                python_stack.view(sample);
 
-            Renderer::get().render_stack_end(MetricType::Time, delta);
+            Renderer::get().render_sample(sample);
         }
     }
 
@@ -17,6 +17,9 @@ typedef unsigned long microsecond_t;
 
 inline microsecond_t last_time = 0;
 
+// Time of the current sampling sweep
+inline microsecond_t sample_time = 0;
+
 #define TS_TO_MICROSECOND(ts) ((ts).tv_sec * 1e6 + (ts).tv_nsec / 1e3)
 #define TV_TO_MICROSECOND(tv) ((tv).seconds * 1e6 + (tv).microseconds)
 
@@ -0,0 +1,544 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef LZMA_DISABLE
+#include <lzma.h>
+#endif  // LZMA_DISABLE
+
+#include <echion/config.h>
+#include <echion/errors.h>
+#include <echion/index.h>
+#include <echion/mojo.h>
+#include <echion/sink.h>
+
+// ----------------------------------------------------------------------------
+// Asynchronous output. Records are appended to a ring of in-memory chunks,
+// and a dedicated writer thread drains the full chunks to the output file
+// with writev. The threads that produce the records never touch the file, so
+// a slow disk cannot stall sampling. When the ring is full, records that can
+// be dropped (i.e. samples) are discarded and counted, while anything else
+// (e.g. definitions, which later samples may refer to) waits for space.
+//
+// When compression is enabled, the writer thread streams the output through
+// an xz encoder. The encoder is flushed at the configured interval, so that
+// a streaming decoder can read everything up to the last flush while the
+// output is still being written.
+//
+// When rotation is enabled, the output is split into numbered segments. The
+// segment being written has a .part suffix, which is dropped with an atomic
+// rename once the segment is complete. Producers decide when to rotate (see
+// restart_due) and pass the records that each new segment must start with.
+//
+// The output, and each segment, ends with an index of its content (see
+// MojoIndex), so that readers can seek to the definitions and to the time
+// range and threads they are interested in.
+class OutputWriter : public OutputSink
+{
+public:
+    // ------------------------------------------------------------------------
+    [[nodiscard]] Result<void> open(const char* output) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        path = output;
+        segmented = rotate_size > 0 || rotate_interval > 0;
+        segment = 0;
+
+        if (!open_file())
+            return ErrorKind::RendererError;
+
+        for (auto& chunk : chunks)
+        {
+            chunk.buffer.clear();
+            chunk.ends_segment = false;
+        }
+        head = ready = 0;
+        dropped = 0;
+        stopping = false;
+        owner = getpid();
+        start_segment();
+
+        thread = new std::thread([this]() { this->drain(); });
+
+        return Result<void>::ok();
+    }
+
+    // ------------------------------------------------------------------------
+    // Write out everything that has been appended so far and stop the writer
+    // thread.
+    void close() override
+    {
+        std::thread* writer_thread;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+
+            if (thread != nullptr)
+                end_segment(guard);
+
+            writer_thread = thread;
+            thread = nullptr;
+            stopping = true;
+        }
+
+        if (writer_thread == nullptr)
+            return;
+
+        work.notify_one();
+        space.notify_all();
+        writer_thread->join();
+        delete writer_thread;
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        close_file();
+    }
+
+    // ------------------------------------------------------------------------
+    bool write(const char* data, size_t size, RecordKind kind,
+               std::string_view thread_name) override
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        if (thread == nullptr)
+            return false;
+
+        auto offset = segment_bytes;
+        if (!append(guard, data, size, kind == RECORD_SAMPLE))
+            return false;
+
+        index.add(offset, size, kind, thread_name);
+
+        // The preamble is not counted, or a preamble that outgrew the limit
+        // would rotate the output at every record.
+        if (rotate_size > 0 && segment_bytes - preamble_bytes >= rotate_size)
+            due = true;
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool needs_preamble() const override
+    {
+        return segmented;
+    }
+
+    // ------------------------------------------------------------------------
+    // Whether the current segment has reached its size or age limit.
+    bool restart_due() override
+    {
+        if (!segmented)
+            return false;
+
+        if (rotate_interval > 0 && !due &&
+            std::chrono::steady_clock::now().time_since_epoch().count() - segment_start >=
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::seconds(rotate_interval))
+                    .count())
+            due = true;
+
+        return due;
+    }
+
+    // ------------------------------------------------------------------------
+    // End the current segment and start a new one with the given records.
+    void restart(const MojoBuffer& preamble) override
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        if (thread == nullptr || !due)
+            return;
+
+        end_segment(guard);
+
+        fill().ends_segment = true;
+        if (!next_chunk(guard, false))
+            return;
+
+        start_segment();
+
+        fill().buffer.raw(preamble.data(), preamble.size());
+        index.add(0, preamble.size(), RECORD_DEFINITION, {});
+        segment_bytes += preamble.size();
+        preamble_bytes = preamble.size();
+    }
+
+    // ------------------------------------------------------------------------
+    size_t dropped_records() override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        return dropped;
+    }
+
+    // ------------------------------------------------------------------------
+    bool forked() const override
+    {
+        return owner != 0 && owner != getpid();
+    }
+
+private:
+    static constexpr size_t RING_SIZE = 16;
+    static constexpr size_t CHUNK_SIZE = 256 << 10;
+    static constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(100);
+
+    struct Chunk
+    {
+        MojoBuffer buffer;
+        bool ends_segment = false;  // The file is rotated after this chunk
+    };
+
+    std::array<Chunk, RING_SIZE> chunks;
+    size_t head = 0;   // The oldest chunk waiting to be written
+    size_t ready = 0;  // The number of chunks waiting to be written
+
+    std::string path;
+    int fd = -1;
+    size_t dropped = 0;
+    bool stopping = false;
+    pid_t owner = 0;
+
+    // Rotation state. The segment number and file are only touched by the
+    // writer thread once it is running.
+    bool segmented = false;
+    unsigned int segment = 0;
+    size_t segment_bytes = 0;
+    size_t preamble_bytes = 0;  // At the start of the segment
+    std::atomic<std::chrono::steady_clock::rep> segment_start = 0;
+    std::atomic<bool> due = false;
+    MojoIndex index;
+
+    std::mutex lock;
+    std::condition_variable work;
+    std::condition_variable space;
+    std::thread* thread = nullptr;
+
+#ifndef LZMA_DISABLE
+    // Compression state, only used by the writer thread once it is running.
+    lzma_stream xz = LZMA_STREAM_INIT;
+    bool xz_active = false;
+    bool xz_pending = false;  // Data was encoded since the last flush
+    std::chrono::steady_clock::time_point last_flush;
+    std::array<uint8_t, 64 << 10> xz_buffer;
+#endif  // LZMA_DISABLE
+
+    // ------------------------------------------------------------------------
+    // The chunk that records are currently appended to.
+    inline Chunk& fill()
+    {
+        return chunks[(head + ready) % RING_SIZE];
+    }
+
+    // ------------------------------------------------------------------------
+    // Hand the current chunk over to the writer thread. If the ring is full,
+    // this either fails or waits for space.
+    bool next_chunk(std::unique_lock<std::mutex>& guard, bool droppable)
+    {
+        if (ready + 1 == RING_SIZE)
+        {
+            if (droppable)
+            {
+                dropped++;
+                return false;
+            }
+
+            space.wait(guard, [this]() { return ready + 1 < RING_SIZE || thread == nullptr; });
+            if (thread == nullptr)
+                return false;
+        }
+
+        ready++;
+        work.notify_one();
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool append(std::unique_lock<std::mutex>& guard, const char* data, size_t size,
+                bool droppable)
+    {
+        if (!fill().buffer.empty() && fill().buffer.size() + size > CHUNK_SIZE)
+        {
+            if (!next_chunk(guard, droppable))
+                return false;
+        }
+
+        fill().buffer.raw(data, size);
+        segment_bytes += size;
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    // Write the index of the current segment at its end.
+    void end_segment(std::unique_lock<std::mutex>& guard)
+    {
+        auto footer = index.footer(segment_bytes);
+
+        append(guard, footer.data(), footer.size(), false);
+    }
+
+    // ------------------------------------------------------------------------
+    inline void start_segment()
+    {
+        index.clear();
+        segment_bytes = 0;
+        preamble_bytes = 0;
+        segment_start = std::chrono::steady_clock::now().time_since_epoch().count();
+        due = false;
+    }
+
+    // ------------------------------------------------------------------------
+    std::string segment_path() const
+    {
+        return segmented ? numbered_path(path, segment) : path;
+    }
+
+    // ------------------------------------------------------------------------
+    bool open_file()
+    {
+        auto file_path = segment_path() + (segmented ? ".part" : "");
+
+        fd = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+
+#ifndef LZMA_DISABLE
+        xz_active = false;
+        if (compression >= 0)
+        {
+            xz = LZMA_STREAM_INIT;
+            if (lzma_easy_encoder(&xz, static_cast<uint32_t>(compression), LZMA_CHECK_CRC32) !=
+                LZMA_OK)
+            {
+                ::close(fd);
+                fd = -1;
+                return false;
+            }
+            xz_active = true;
+            xz_pending = false;
+            last_flush = std::chrono::steady_clock::now();
+        }
+#endif  // LZMA_DISABLE
+
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    void close_file()
+    {
+        if (fd < 0)
+            return;
+
+#ifndef LZMA_DISABLE
+        if (xz_active)
+        {
+            encode(nullptr, 0, LZMA_FINISH);
+            lzma_end(&xz);
+            xz_active = false;
+        }
+#endif  // LZMA_DISABLE
+
+        ::close(fd);
+        fd = -1;
+
+        if (segmented)
+        {
+            auto file_path = segment_path();
+            if (std::rename((file_path + ".part").c_str(), file_path.c_str()))
+                std::cerr << "Failed to rename output segment " << file_path << ": "
+                          << std::strerror(errno) << std::endl;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    void next_file()
+    {
+        close_file();
+
+        segment++;
+        if (!open_file())
+            std::cerr << "Failed to open output segment " << segment_path() << std::endl;
+    }
+
+    // ------------------------------------------------------------------------
+    void drain()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        for (;;)
+        {
+            work.wait_for(guard, FLUSH_INTERVAL, [this]() { return ready > 0 || stopping; });
+
+            // Flush partially filled chunks periodically, and on close.
+            if (ready == 0 && !fill().buffer.empty())
+                ready++;
+
+            if (ready == 0)
+            {
+                if (stopping)
+                    break;
+
+#ifndef LZMA_DISABLE
+                if (xz_active)
+                {
+                    guard.unlock();
+                    maybe_flush_compressed();
+                    guard.lock();
+                }
+#endif  // LZMA_DISABLE
+
+                continue;
+            }
+
+            // Write out the chunks that are ready, up to the end of the
+            // current segment.
+            size_t count = 0;
+            bool rotate_file = false;
+            std::array<struct iovec, RING_SIZE> iov;
+            while (count < ready && !rotate_file)
+            {
+                auto& chunk = chunks[(head + count) % RING_SIZE];
+                iov[count].iov_base = const_cast<char*>(chunk.buffer.data());
+                iov[count].iov_len = chunk.buffer.size();
+                rotate_file = chunk.ends_segment;
+                count++;
+            }
+
+            // The chunks that are ready are not touched by producers, so we
+            // can write them out without holding the lock.
+            guard.unlock();
+#ifndef LZMA_DISABLE
+            if (xz_active)
+                compress(iov.data(), count);
+            else
+#endif  // LZMA_DISABLE
+                write_all(iov.data(), count);
+            if (rotate_file)
+                next_file();
+            guard.lock();
+
+            for (size_t i = 0; i < count; i++)
+            {
+                auto& chunk = chunks[(head + i) % RING_SIZE];
+                chunk.buffer.clear();
+                chunk.ends_segment = false;
+            }
+            head = (head + count) % RING_SIZE;
+            ready -= count;
+
+            space.notify_all();
+        }
+    }
+
+#ifndef LZMA_DISABLE
+    // ------------------------------------------------------------------------
+    void compress(const struct iovec* iov, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+            encode(static_cast<const uint8_t*>(iov[i].iov_base), iov[i].iov_len, LZMA_RUN);
+
+        xz_pending = true;
+
+        maybe_flush_compressed();
+    }
+
+    // ------------------------------------------------------------------------
+    void maybe_flush_compressed()
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (!xz_pending || now - last_flush < std::chrono::milliseconds(compression_flush))
+            return;
+
+        // Complete the current block so that decoders can catch up.
+        encode(nullptr, 0, LZMA_SYNC_FLUSH);
+
+        xz_pending = false;
+        last_flush = now;
+    }
+
+    // ------------------------------------------------------------------------
+    void encode(const uint8_t* data, size_t size, lzma_action action)
+    {
+        xz.next_in = data;
+        xz.avail_in = size;
+
+        for (;;)
+        {
+            xz.next_out = xz_buffer.data();
+            xz.avail_out = xz_buffer.size();
+
+            auto ret = lzma_code(&xz, action);
+
+            size_t produced = xz_buffer.size() - xz.avail_out;
+            if (produced)
+            {
+                struct iovec iov = {xz_buffer.data(), produced};
+                write_all(&iov, 1);
+            }
+
+            if (ret == LZMA_STREAM_END)
+                break;
+
+            if (ret != LZMA_OK)
+            {
+                std::cerr << "Failed to compress output (error " << ret << ")" << std::endl;
+                break;
+            }
+
+            if (action == LZMA_RUN && xz.avail_in == 0)
+                break;
+        }
+    }
+#endif  // LZMA_DISABLE
+
+    // ------------------------------------------------------------------------
+    void write_all(struct iovec* iov, size_t count)
+    {
+        while (count > 0)
+        {
+            auto n = ::writev(fd, iov, static_cast<int>(count));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                std::cerr << "Failed to write output: " << std::strerror(errno) << std::endl;
+                return;
+            }
+
+            // Skip over what has been written.
+            auto written = static_cast<size_t>(n);
+            while (count > 0 && written >= iov->iov_len)
+            {
+                written -= iov->iov_len;
+                iov++;
+                count--;
+            }
+
+            if (count > 0)
+            {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+                iov->iov_len -= written;
+            }
+        }
+    }
+};
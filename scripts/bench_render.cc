@@ -0,0 +1,98 @@
+// This file is part of "echion" which is released under MIT.
+//
+// Copyright (c) 2023 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+//
+// Throughput benchmark for the MOJO renderer. Each thread renders synthetic
+// samples of a fixed depth through the Renderer facade, either one event at a
+// time or one sample at a time with the renderer pinned, and the result is
+// reported in samples per second. Run it with scripts/bench_render.sh.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <echion/render.h>
+
+// ----------------------------------------------------------------------------
+static void render_events(size_t samples, size_t depth)
+{
+    const std::string thread_name = "BenchThread";
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        Renderer::get().render_stack_begin(42, 0, thread_name);
+        for (size_t j = 0; j < depth; j++)
+            Renderer::get().frame_ref(0x7f0000000000 + ((i + j) & 0xffff) * 64);
+        Renderer::get().render_stack_end(MetricType::Time, 1000 + (i & 0xff));
+    }
+}
+
+// ----------------------------------------------------------------------------
+static void render_samples(size_t samples, size_t depth)
+{
+    const std::string thread_name = "BenchThread";
+    std::vector<mojo_ref_t> frames(depth);
+
+    Renderer::get().pin();
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        for (size_t j = 0; j < depth; j++)
+            frames[j] = 0x7f0000000000 + ((i + j) & 0xffff) * 64;
+
+        SampleView sample;
+        sample.pid = 42;
+        sample.thread_name = &thread_name;
+        sample.frames = frames.data();
+        sample.frame_count = depth;
+        sample.delta = 1000 + (i & 0xff);
+
+        Renderer::get().render_sample(sample);
+    }
+
+    Renderer::get().unpin();
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    size_t samples = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    size_t depth = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+
+    if (std::getenv("ECHION_OUTPUT") == nullptr)
+        setenv("ECHION_OUTPUT", "/dev/null", 1);
+
+    for (auto [mode, render] : {std::make_pair("events", render_events),
+                                std::make_pair("samples", render_samples)})
+    {
+        for (size_t threads : {1, 4})
+        {
+            if (!Renderer::get().open())
+                return 1;
+
+            Renderer::get().header();
+
+            auto start = std::chrono::steady_clock::now();
+
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < threads; t++)
+                workers.emplace_back(render, samples, depth);
+            for (auto& worker : workers)
+                worker.join();
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            Renderer::get().close();
+
+            std::cout << "mode=" << mode << " threads=" << threads << " depth=" << depth
+                      << " samples=" << threads * samples << " time=" << elapsed.count() << "s"
+                      << " rate=" << static_cast<size_t>(threads * samples / elapsed.count())
+                      << " samples/s" << std::endl;
+        }
+    }
+
+    return 0;
+}
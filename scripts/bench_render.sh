@@ -0,0 +1,20 @@
+#!/bin/bash
+# Build and run the renderer throughput benchmark.
+#
+#   scripts/bench_render.sh [SAMPLES_PER_THREAD] [DEPTH]
+set -euo pipefail
+
+REPO_ROOT="$(dirname "$(dirname "$(realpath "$0")")")"
+BUILD_DIR="$(mktemp -d)"
+trap 'rm -rf "$BUILD_DIR"' EXIT
+
+PYTHON="${PYTHON:-python3}"
+PY_INCLUDE="$($PYTHON -c "import sysconfig; print(sysconfig.get_paths()['include'])")"
+PY_LDFLAGS="$(${PYTHON}-config --embed --ldflags 2>/dev/null || ${PYTHON}-config --ldflags)"
+
+g++ -O2 -Wall -Wextra -std=c++17 -DUNWIND_NATIVE_DISABLE -DLZMA_DISABLE -DPL_LINUX \
+    -I"$REPO_ROOT" -I"$PY_INCLUDE" \
+    "$REPO_ROOT/scripts/bench_render.cc" "$REPO_ROOT/echion/render.cc" "$REPO_ROOT/echion/danger.cc" \
+    -o "$BUILD_DIR/bench_render" $PY_LDFLAGS -lpthread
+
+"$BUILD_DIR/bench_render" "$@"
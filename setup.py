@@ -15,8 +15,14 @@ PLATFORM = sys.platform.lower()
 
 DISABLE_NATIVE = os.environ.get("UNWIND_NATIVE_DISABLE")
 
+# Output compression requires liblzma, which is only linked on Linux.
+DISABLE_LZMA = os.environ.get("LZMA_DISABLE") or PLATFORM != "linux"
+
 LDADD = {
-    "linux": ["-l:libunwind.a", "-l:liblzma.a"] if not DISABLE_NATIVE else [],
+    "linux": (["-l:libunwind.a"] if not DISABLE_NATIVE else [])
+    + (["-l:liblzma.a"] if not DISABLE_LZMA else [])
+    # shm_open lives in librt with older glibc versions.
+    + ["-lrt"],
 }
 
 # add option to colorize compiler output
@@ -32,6 +38,9 @@ else:
 if DISABLE_NATIVE:
     CFLAGS += ["-DUNWIND_NATIVE_DISABLE"]
 
+if DISABLE_LZMA:
+    CFLAGS += ["-DLZMA_DISABLE"]
+
 echionmodule = Extension(
     "echion.core",
     sources=["echion/coremodule.cc", "echion/frame.cc", "echion/render.cc", "echion/danger.cc"],
@@ -0,0 +1,53 @@
+import os
+import sys
+from signal import SIGUSR2
+from threading import Thread
+from time import monotonic as time
+from time import sleep
+
+import echion.core as ec
+
+
+def cpu_sleep(t):
+    end = time() + t
+    while time() <= end:
+        pass
+
+
+def early():
+    cpu_sleep(1.5)
+
+
+def late():
+    cpu_sleep(1.5)
+
+
+def idle():
+    sleep(10)
+
+
+def fail():
+    raise RuntimeError("flight recorder test")
+
+
+if __name__ == "__main__":
+    trigger, path = sys.argv[1:]
+
+    # A thread with the same stack throughout, for samples to fold
+    Thread(target=idle, name="IdleThread", daemon=True).start()
+
+    early()
+    late()
+
+    if trigger == "api":
+        print(ec.dump(path or None))
+
+    elif trigger == "signal":
+        os.kill(os.getpid(), SIGUSR2)
+        # The dump is taken by the sampler
+        sleep(0.5)
+
+    elif trigger == "exception":
+        t = Thread(target=fail)
+        t.start()
+        t.join()
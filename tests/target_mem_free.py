@@ -0,0 +1,33 @@
+from time import sleep
+
+kept = []
+more = []
+
+
+def keep():
+    for _ in range(10_000):
+        kept.append(bytearray(2000))
+
+
+def grow():
+    for _ in range(2_000):
+        more.append(bytearray(2000))
+
+
+def release():
+    kept.clear()
+
+
+if __name__ == "__main__":
+    # The allocator hooks are installed by the sampler once it has started
+    sleep(0.2)
+
+    keep()
+
+    # Make the memory samples of keep go out with the next aggregation, so
+    # that the memory it frees later shows up as a net free.
+    sleep(1.5)
+    grow()
+    sleep(0.1)
+
+    release()
@@ -0,0 +1,24 @@
+import sys
+from collections import deque
+from time import sleep
+
+leaked = []
+cached = deque(maxlen=4)
+
+
+def leak():
+    leaked.append(bytearray(100_000))
+
+
+def cache():
+    cached.append(bytearray(100_000))
+
+
+if __name__ == "__main__":
+    (mode,) = sys.argv[1:]
+
+    for _ in range(300):
+        if mode == "leak":
+            leak()
+        cache()
+        sleep(0.01)
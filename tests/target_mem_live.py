@@ -0,0 +1,37 @@
+import os
+import sys
+from signal import SIGUSR1
+from time import sleep
+
+import echion.core as ec
+
+kept = []
+
+
+def keep():
+    for _ in range(10_000):
+        kept.append(bytearray(2000))
+
+
+def churn():
+    for _ in range(10_000):
+        bytearray(2000)
+
+
+if __name__ == "__main__":
+    # The allocator hooks are installed by the sampler once it has started
+    sleep(0.2)
+
+    keep()
+    churn()
+
+    if len(sys.argv) > 1:
+        trigger, path = sys.argv[1:]
+
+        if trigger == "api":
+            print(ec.heap_snapshot(path or None))
+
+        elif trigger == "signal":
+            os.kill(os.getpid(), SIGUSR1)
+            # The snapshot is taken by the sampler
+            sleep(0.5)
@@ -0,0 +1,39 @@
+import sys
+from threading import Thread
+from time import sleep
+
+import echion.core as ec
+
+kept = []
+
+
+def work(depth, n):
+    # Each thread allocates from a stack of its own
+    if depth:
+        return work(depth - 1, n)
+
+    for _ in range(n):
+        kept.append(bytearray(2000))
+
+
+def linger(depth, n):
+    work(depth, n)
+    sleep(0.3)
+
+
+if __name__ == "__main__":
+    # The allocator hooks are installed by the sampler once it has started
+    sleep(0.2)
+
+    (path,) = sys.argv[1:]
+
+    # Short threads are done well within a sampling interval
+    threads = [Thread(target=work, args=(i, 100), name=f"Short-{i}") for i in range(8)]
+    threads += [Thread(target=linger, args=(8 + i, 1000), name=f"Long-{8 + i}") for i in range(2)]
+
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    print(ec.heap_snapshot(path))
@@ -0,0 +1,38 @@
+from tests.utils import DataSummary
+from tests.utils import run_target
+from tests.utils import retry_on_valueerror
+
+
+@retry_on_valueerror()
+def test_asyncio_task_names_fold():
+    result, data = run_target("target_gather_tasks", "--task-names", "fold")
+    assert result.returncode == 0, result.stderr.decode()
+
+    assert data is not None
+    summary = DataSummary(data)
+
+    # The gathered tasks F4_0 and F4_1 are folded onto a single F4 task, and so
+    # is the default name of the main task.
+    summary.assert_substack(
+        "0:MainThread",
+        ("Task", "main", "F1", "f1", "f2", "F3", "f3", "F4", "f4", "f5", "sleep"),
+        lambda v: v >= 0.9e6,
+    )
+    summary.assert_not_substack("0:MainThread", ("F4_0",))
+    summary.assert_not_substack("0:MainThread", ("F4_1",))
+
+
+@retry_on_valueerror()
+def test_asyncio_task_names_coro():
+    result, data = run_target("target_gather_tasks", "--task-names", "coro")
+    assert result.returncode == 0, result.stderr.decode()
+
+    assert data is not None
+    summary = DataSummary(data)
+
+    # Task names are replaced by the name of the task coroutine
+    summary.assert_substack(
+        "0:MainThread",
+        ("main", "main", "f1", "f1", "f2", "f3", "f3", "f4", "f4", "f5", "sleep"),
+        lambda v: v >= 0.9e6,
+    )
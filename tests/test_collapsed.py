@@ -0,0 +1,69 @@
+from tests.utils import retry_on_valueerror
+from tests.utils import run_target_output
+
+
+def read_collapsed(path):
+    stacks = {}
+    for line in path.read_text().splitlines():
+        folded, _, metric = line.rpartition(" ")
+        # Drop the locations, and keep the function names only
+        frames = tuple(_.partition(" (")[0] for _ in folded.split(";"))
+        stacks[frames] = stacks.get(frames, 0) + int(metric)
+    return stacks
+
+
+@retry_on_valueerror()
+def test_collapsed():
+    result, output = run_target_output("target", ".txt", "--format", "collapsed")
+    assert result.returncode == 0, result.stderr.decode()
+
+    stacks = read_collapsed(output)
+
+    threads = {frames[0] for frames in stacks}
+    assert {"MainThread", "SecondaryThread"} <= threads, threads
+
+    for thread in ("MainThread", "SecondaryThread"):
+        cpu_sleep = sum(
+            v
+            for frames, v in stacks.items()
+            if frames[0] == thread and frames[-4:] == ("main", "bar", "foo", "cpu_sleep")
+        )
+        assert cpu_sleep >= 0.45e6
+
+
+@retry_on_valueerror()
+def test_collapsed_tasks():
+    result, output = run_target_output(
+        "target_gather_tasks", ".txt", "--format", "collapsed"
+    )
+    assert result.returncode == 0, result.stderr.decode()
+
+    stacks = read_collapsed(output)
+
+    for task in ("F4_0", "F4_1"):
+        task_stacks = [frames for frames in stacks if task in frames]
+        assert task_stacks, stacks
+
+        for frames in task_stacks:
+            # The task name is a frame of its own, and appears once
+            assert frames[0] == "MainThread"
+            assert frames.count(task) == 1, frames
+            assert frames[frames.index(task) + 1] == "f4", frames
+
+
+@retry_on_valueerror()
+def test_collapsed_memory():
+    result, output = run_target_output(
+        "target_mem_free", ".txt", "-m", "--format", "collapsed", "-a", "1"
+    )
+    assert result.returncode == 0, result.stderr.decode()
+
+    stacks = read_collapsed(output)
+
+    kept = sum(v for frames, v in stacks.items() if frames[-1:] == ("keep",))
+    assert kept >= 20e6, stacks
+
+    # The memory freed by keep after its allocations have been written out
+    # makes for a net free, which is left out, rather than written as a
+    # wrapped around total.
+    assert all(0 < v < 1 << 63 for v in stacks.values()), stacks
@@ -0,0 +1,109 @@
+import sys
+import typing as t
+from pathlib import Path
+
+import pytest
+from austin.format.mojo import MojoFile
+
+from tests.utils import DataSummary
+from tests.utils import PprofProfile
+from tests.utils import profile_path
+from tests.utils import run_echion
+
+DUMPED = "echion: flight recorder dumped to "
+
+
+def run_flight_recorder(
+    test_name: str, trigger: str, *args: str, suffix: str = ".mojo", path: str = ""
+) -> t.List[Path]:
+    """Run the target with a 1s flight recorder and return the dumps."""
+    output = profile_path(test_name, suffix)
+
+    result = run_echion(
+        "-o",
+        str(output),
+        "--flight-recorder",
+        "1",
+        *args,
+        sys.executable,
+        "-m",
+        "tests.target_flight_recorder",
+        trigger,
+        path,
+    )
+    assert result.returncode == 0, result.stderr.decode()
+
+    if trigger == "api":
+        return [Path(result.stdout.decode().strip())]
+
+    return [
+        Path(line[len(DUMPED) :])
+        for line in result.stderr.decode().splitlines()
+        if line.startswith(DUMPED)
+    ]
+
+
+def read_dump(path: Path) -> DataSummary:
+    data = MojoFile(path.open(mode="rb"))
+    data.unwind()
+    return DataSummary(data)
+
+
+def assert_window(summary: DataSummary) -> None:
+    # Only the samples within the window are kept
+    assert summary.query("0:MainThread", ("late", "cpu_sleep")) is not None
+    assert summary.query("0:MainThread", ("early", "cpu_sleep")) is None
+
+
+@pytest.mark.parametrize("trigger", ["api", "signal", "exception"])
+def test_flight_recorder(trigger):
+    dumps = run_flight_recorder(f"test_flight_recorder_{trigger}", trigger)
+    assert len(dumps) == 1, dumps
+
+    (dump,) = dumps
+    assert dump.is_file()
+
+    summary = read_dump(dump)
+    assert summary.metadata["mode"] == "wall"
+    assert_window(summary)
+
+
+def test_flight_recorder_path():
+    path = profile_path("test_flight_recorder_path", ".dump.mojo")
+
+    (dump,) = run_flight_recorder("test_flight_recorder_path", "api", path=str(path))
+    assert dump == path
+
+    assert_window(read_dump(dump))
+
+
+def test_flight_recorder_pprof():
+    (dump,) = run_flight_recorder(
+        "test_flight_recorder_pprof", "api", "--format", "pprof", suffix=".pb.gz"
+    )
+
+    profile = PprofProfile(dump.read_bytes())
+    assert profile.sample_types == [("samples", "count"), ("wall", "microseconds")]
+
+    # Only the samples within the window are kept
+    _, wall = profile.query("MainThread", ("late", "cpu_sleep"))
+    assert 0.5e6 <= wall <= 1.5e6
+    assert profile.query("MainThread", ("early", "cpu_sleep")) == [0, 0]
+
+
+def test_flight_recorder_pprof_fold():
+    (dump,) = run_flight_recorder(
+        "test_flight_recorder_pprof_fold",
+        "api",
+        "--format",
+        "pprof",
+        "--fold",
+        "1",
+        suffix=".pb.gz",
+    )
+
+    # Folded samples count for as many samples as they stand for
+    count, wall = PprofProfile(dump.read_bytes()).query("IdleThread", ("idle",))
+    # Runs of samples are kept whole, so the window can hold more than 1s
+    assert 0.5e6 <= wall <= 2.5e6
+    assert 0.5 * wall <= count * 1000 <= 1.1 * wall, (count, wall)
@@ -0,0 +1,34 @@
+from tests.utils import MojoProfile
+from tests.utils import retry_on_valueerror
+from tests.utils import run_target_output
+
+MOJO_VERSION_STACK_REFS = 4
+
+
+@retry_on_valueerror()
+def test_fold():
+    result, output = run_target_output("target", ".mojo", "--fold", "1")
+    assert result.returncode == 0, result.stderr.decode()
+
+    data = output.read_bytes()
+
+    # Folded samples carry their count, which needs version 4 of the format
+    assert data[:4] == b"MOJ" + bytes([MOJO_VERSION_STACK_REFS])
+
+    profile = MojoProfile(data)
+
+    for thread in ("MainThread", "SecondaryThread"):
+        # The 2 seconds of sleep in bar make for a couple of runs of 1 second
+        runs = [
+            values
+            for sample_thread, stack, values in profile.samples
+            if sample_thread == thread and stack[-2:] == ("main", "bar")
+        ]
+        assert 2 <= len(runs) <= 4, runs
+
+        count = sum(c for c, _ in runs)
+        wall = sum(w for _, w in runs)
+        assert 1.8e6 <= wall <= 2.5e6, runs
+
+        # Each sample stands for at least the sampling interval of 1ms
+        assert 0.5 * wall <= count * 1000 <= 1.1 * wall, runs
@@ -0,0 +1,114 @@
+import sys
+import typing as t
+from pathlib import Path
+
+from tests.utils import MojoProfile
+from tests.utils import PprofProfile
+from tests.utils import profile_path
+from tests.utils import run_echion
+
+WRITTEN = "echion: heap snapshot written to "
+
+
+def run_heap_snapshot(
+    test_name: str, trigger: str, *args: str, suffix: str = ".mojo", path: str = ""
+) -> Path:
+    """Run the target in memory mode and return its heap snapshot."""
+    output = profile_path(test_name, suffix)
+
+    result = run_echion(
+        "-m",
+        "-o",
+        str(output),
+        *args,
+        sys.executable,
+        "-m",
+        "tests.target_mem_live",
+        trigger,
+        path,
+    )
+    assert result.returncode == 0, result.stderr.decode()
+
+    if trigger == "api":
+        return Path(result.stdout.decode().strip())
+
+    (snapshot,) = [
+        Path(line[len(WRITTEN) :])
+        for line in result.stderr.decode().splitlines()
+        if line.startswith(WRITTEN)
+    ]
+    return snapshot
+
+
+def assert_live(count: int, size: int) -> None:
+    # Each of the 10k bytearrays that are kept holds on to its 2000 bytes
+    assert 10_000 <= count <= 30_000, count
+    assert 20e6 <= size <= 25e6, size
+
+
+def test_heap_snapshot():
+    path = profile_path("test_heap_snapshot", ".heap.mojo")
+
+    snapshot = run_heap_snapshot(
+        "test_heap_snapshot", "api", "--stack-refs", path=str(path)
+    )
+    assert snapshot == path
+
+    profile = MojoProfile(snapshot.read_bytes())
+    assert profile.metadata["mode"] == "memory"
+
+    assert_live(*profile.query("MainThread", ("keep",)))
+
+    # What churn allocates is freed before the snapshot
+    count, size = profile.query("MainThread", ("churn",))
+    assert size < 1e6, (count, size)
+
+
+def test_heap_snapshot_object_count():
+    path = profile_path("test_heap_snapshot_object_count", ".heap.mojo")
+
+    # Snapshots carry the number of objects whether stacks are interned or not
+    snapshot = run_heap_snapshot("test_heap_snapshot_object_count", "api", path=str(path))
+
+    data = snapshot.read_bytes()
+    assert data[:4] == b"MOJ\x04"
+
+    assert_live(*MojoProfile(data).query("MainThread", ("keep",)))
+
+
+def test_heap_snapshot_pprof():
+    snapshot = run_heap_snapshot(
+        "test_heap_snapshot_pprof", "api", "--format", "pprof", suffix=".pb.gz"
+    )
+    # Snapshots are numbered after the output
+    assert snapshot.name == "test_heap_snapshot_pprof-0001.pb.gz", snapshot
+
+    profile = PprofProfile(snapshot.read_bytes())
+    assert profile.sample_types == [("samples", "count"), ("inuse_space", "bytes")]
+
+    assert_live(*profile.query("MainThread", ("keep",)))
+
+
+def test_heap_snapshot_signal():
+    snapshot = run_heap_snapshot(
+        "test_heap_snapshot_signal", "signal", "--stack-refs", "--heap-snapshot-signal"
+    )
+    assert snapshot.name == "test_heap_snapshot_signal-0001.mojo", snapshot
+
+    assert_live(*MojoProfile(snapshot.read_bytes()).query("MainThread", ("keep",)))
+
+
+def test_heap_snapshot_sample_rate():
+    snapshot = run_heap_snapshot(
+        "test_heap_snapshot_sample_rate",
+        "api",
+        "--stack-refs",
+        "--memory-sample-rate",
+        "64K",
+    )
+
+    # The objects are estimated like the bytes. Each sampled bytearray object
+    # stands for over a thousand others, so the count is only roughly right.
+    count, size = MojoProfile(snapshot.read_bytes()).query("MainThread", ("keep",))
+    assert 10_000 <= count <= 40_000, count
+    assert 16e6 <= size <= 25e6, size
@@ -0,0 +1,83 @@
+from austin.format.mojo import MojoFile
+
+from echion.index import read_index
+from tests.utils import retry_on_valueerror
+from tests.utils import run_target_output
+
+MOJO_METADATA = 1
+MOJO_STACK = 2
+MOJO_DEFINITIONS = {MOJO_METADATA, 3, 11, 13}  # Metadata, frames, strings, stacks
+
+
+def sample_thread(data: bytes, start: int) -> str:
+    """The thread name of the sample at the given offset."""
+    assert data[start] == MOJO_STACK
+    i = start + 1
+    for _ in range(2):  # Skip the PID and the IID
+        while data[i] & 0x80:
+            i += 1
+        i += 1
+    return data[i : data.index(b"\x00", i)].decode()
+
+
+@retry_on_valueerror()
+def test_index():
+    result, output = run_target_output("target", ".mojo")
+    assert result.returncode == 0, result.stderr.decode()
+
+    index = read_index(str(output))
+    assert index is not None
+
+    data = output.read_bytes()
+
+    # The index is made of metadata events at the end of the file
+    assert data[index.offset] == MOJO_METADATA
+    assert data[index.offset + 1 :].startswith(b"index_definitions\x00")
+
+    # The first block of definitions starts with the header, and every
+    # block ends before the index.
+    assert index.definitions[0][0] == 0
+    assert data.startswith(b"MOJ")
+    for start, size in index.definitions:
+        assert start + size <= index.offset
+    for start, _ in index.definitions[1:]:
+        assert data[start] in MOJO_DEFINITIONS, start
+
+    # Time entries are in order, and point to samples
+    assert index.times
+    assert index.times == sorted(index.times)
+    for _, start in index.times:
+        assert data[start] == MOJO_STACK
+    assert index.seek_time(0) == index.times[0][1]
+    assert index.seek_time(index.times[-1][0] + 1) == index.offset
+
+    # Thread entries point to the first and last samples of each thread
+    assert {"MainThread", "SecondaryThread"} <= set(index.threads)
+    for thread, (first, last) in index.threads.items():
+        assert first <= last < index.offset
+        for start in (first, last):
+            assert sample_thread(data, start) == thread
+
+    # The index does not get in the way of readers that do not know about it
+    m = MojoFile(output.open(mode="rb"))
+    m.unwind()
+    assert m.metadata["mode"] == "wall"
+
+
+def test_index_thread_names(tmp_path):
+    # Thread names can contain the byte of the metadata event
+    index_offset = 4
+    data = (
+        b"MOJ\x03"
+        + b"\x01index_thread\x004-4 a\x01b\x00"
+        + b"\x01index_thread\x004-4 MainThread\x00"
+        + b"\x01index_offset\x00"
+        + str(index_offset).zfill(20).encode()
+        + b"\x00"
+    )
+    output = tmp_path / "index.mojo"
+    output.write_bytes(data)
+
+    index = read_index(str(output))
+    assert index is not None
+    assert index.threads == {"a\x01b": (4, 4), "MainThread": (4, 4)}
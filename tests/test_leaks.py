@@ -0,0 +1,48 @@
+import sys
+import typing as t
+
+from tests.utils import MojoProfile
+from tests.utils import profile_path
+from tests.utils import run_echion
+
+
+def leak_suspects(test_name: str, mode: str) -> t.List[t.Tuple[t.Tuple[str, ...], int]]:
+    """Run the target and return the stacks and the bytes of leak suspects."""
+    output = profile_path(test_name)
+
+    result = run_echion(
+        "-m",
+        "--leak-epochs",
+        # More than the flushes over which the cache fills up
+        "8",
+        "-o",
+        str(output),
+        sys.executable,
+        "-m",
+        "tests.target_mem_leak",
+        mode,
+    )
+    assert result.returncode == 0, result.stderr.decode()
+
+    profile = MojoProfile(output.read_bytes())
+
+    suspects = []
+    for key, value in profile.metadata_entries:
+        if key == "leak_suspect":
+            stack, size, *_ = value.split()
+            suspects.append((profile.stacks[int(stack)], int(size)))
+    return suspects
+
+
+def test_leak_suspect():
+    suspects = leak_suspects("test_leak_suspect", "leak")
+
+    # The stack that keeps growing is a suspect, and not the one whose
+    # allocations are released as new ones come in.
+    sizes = [size for stack, size in suspects if stack[-1] == "leak"]
+    assert sizes and max(sizes) >= 8 * 100_000, suspects
+    assert not [stack for stack, _ in suspects if stack[-1] == "cache"], suspects
+
+
+def test_leak_suspect_flat():
+    assert leak_suspects("test_leak_suspect_flat", "flat") == []
@@ -1,6 +1,12 @@
+import sys
+import typing as t
+
 import pytest
 
 from tests.utils import DataSummary, run_target, retry_on_valueerror
+from tests.utils import MojoProfile
+from tests.utils import profile_path
+from tests.utils import run_echion
 
 
 @retry_on_valueerror()
@@ -22,3 +28,66 @@ def test_memory():
     assert (
         summary.query("0:MainThread", (("<module>", 25), ("leak", 21))) is not None
     ), summary.threads["0:MainThread"]
+
+
+@retry_on_valueerror()
+def test_memory_sample_rate():
+    result, data = run_target("target_mem_live", "-m")
+    assert result.returncode == 0, result.stderr.decode()
+    assert data is not None
+    assert "memory_sample_rate" not in data.metadata
+
+    tracked = DataSummary(data).query("0:MainThread", ("keep",))
+    assert tracked is not None and tracked >= 20e6
+
+    result, data = run_target("target_mem_live", "-m", "--memory-sample-rate", "64K")
+    assert result.returncode == 0, result.stderr.decode()
+    assert data is not None
+    assert data.metadata["memory_sample_rate"] == str(64 << 10)
+
+    # The totals of sampled allocations are estimates of the actual ones
+    sampled = DataSummary(data).query("0:MainThread", ("keep",))
+    assert sampled is not None
+    assert abs(sampled - tracked) <= 0.2 * tracked, (sampled, tracked)
+
+
+def work_totals(profile: MojoProfile) -> t.Dict[t.Tuple[str, int], int]:
+    """Sum the bytes allocated by work, by thread and depth of the stack."""
+    totals: t.Dict[t.Tuple[str, int], int] = {}
+    for thread, stack, (_, size) in profile.samples:
+        if stack and stack[-1] == "work":
+            key = (thread, stack.count("work"))
+            totals[key] = totals.get(key, 0) + size
+    return totals
+
+
+@retry_on_valueerror()
+def test_memory_threads():
+    output = profile_path("test_memory_threads")
+    snapshot = profile_path("test_memory_threads", ".heap.mojo")
+
+    result = run_echion(
+        "-m",
+        "-o",
+        str(output),
+        sys.executable,
+        "-m",
+        "tests.target_mem_threads",
+        str(snapshot),
+    )
+    assert result.returncode == 0, result.stderr.decode()
+
+    # The allocation events of the threads go through their buffers, which
+    # are drained by the sampler, even for threads that are long gone by then.
+    totals = work_totals(MojoProfile(output.read_bytes()))
+
+    # Each thread allocates from a stack of its own, and keeps its name.
+    expected = {(f"Short-{i}", i + 1): 100 for i in range(8)}
+    expected.update({(f"Long-{i}", i + 1): 1000 for i in range(8, 10)})
+    assert set(totals) == set(expected), totals
+    for key, n in expected.items():
+        assert n * 2000 <= totals[key] <= n * 2200, (key, totals[key])
+
+    # Nothing is lost on the way: the totals are those of the allocations that
+    # are still tracked by the memory table.
+    assert work_totals(MojoProfile(snapshot.read_bytes())) == totals
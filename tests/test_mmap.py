@@ -0,0 +1,52 @@
+import sys
+import typing as t
+from shutil import which
+from signal import SIGKILL
+from subprocess import PIPE
+from subprocess import Popen
+from subprocess import run
+from time import sleep
+
+from austin.format.mojo import MojoFile
+
+from tests.utils import DataSummary
+
+
+def test_mmap_recover(tmp_path):
+    output = tmp_path / "echion.mmap"
+    recovered = tmp_path / "echion.mojo"
+
+    p = Popen(
+        [
+            t.cast(str, which("echion")),
+            "-o",
+            f"mmap:{output}",
+            sys.executable,
+            "-m",
+            "tests.target",
+        ],
+        stdout=PIPE,
+        stderr=PIPE,
+    )
+
+    # Kill the target before the sampler has a chance to close the output
+    sleep(2.5)
+    p.send_signal(SIGKILL)
+    p.wait()
+    assert p.returncode == -SIGKILL
+
+    result = run(
+        [sys.executable, "-m", "echion.recover", str(output), str(recovered)],
+        capture_output=True,
+    )
+    assert result.returncode == 0, result.stderr.decode()
+    assert b"was not closed" in result.stderr
+
+    data = MojoFile(recovered.open(mode="rb"))
+    data.unwind()
+
+    assert data.metadata["mode"] == "wall"
+
+    summary = DataSummary(data)
+    assert summary.nthreads >= 2
+    assert summary.query("0:MainThread", ("main", "bar")) is not None
@@ -0,0 +1,24 @@
+from tests.utils import PprofProfile
+from tests.utils import retry_on_valueerror
+from tests.utils import run_target_output
+
+
+@retry_on_valueerror()
+def test_pprof():
+    result, output = run_target_output("target", ".pb.gz", "--format", "pprof")
+    assert result.returncode == 0, result.stderr.decode()
+
+    profile = PprofProfile(output.read_bytes())
+
+    assert profile.sample_types == [("samples", "count"), ("wall", "microseconds")]
+
+    threads = {labels["thread name"] for labels, _, _ in profile.samples}
+    assert {"MainThread", "SecondaryThread"} <= threads, threads
+
+    for thread in ("MainThread", "SecondaryThread"):
+        n, wall = profile.query(thread, ("main", "bar"))
+        assert n > 0
+        assert wall >= 2.5e6
+
+        n, wall = profile.query(thread, ("main", "bar", "foo", "cpu_sleep"))
+        assert wall >= 0.45e6
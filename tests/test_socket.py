@@ -0,0 +1,93 @@
+import io
+import socket
+import sys
+import typing as t
+from shutil import which
+from subprocess import PIPE
+from subprocess import Popen
+from threading import Thread
+from time import monotonic
+from time import sleep
+
+from austin.format.mojo import MojoFile
+
+
+def connect(path: str, timeout: float = 5) -> socket.socket:
+    end = monotonic() + timeout
+    while True:
+        s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            s.connect(path)
+            return s
+        except (FileNotFoundError, ConnectionRefusedError):
+            s.close()
+            if monotonic() > end:
+                raise
+            sleep(0.05)
+
+
+def test_socket(tmp_path):
+    path = str(tmp_path / "echion.sock")
+
+    p = Popen(
+        [
+            t.cast(str, which("echion")),
+            "-i",
+            "100",
+            "-o",
+            f"unix:{path}",
+            "--socket-queue",
+            "16K",
+            sys.executable,
+            "-m",
+            "tests.target",
+        ],
+        stdout=PIPE,
+        stderr=PIPE,
+    )
+
+    try:
+        # A subscriber that never reads is disconnected once it falls behind
+        # by more than the queue limit, and the kernel buffers.
+        stalled = connect(path)
+
+        # Join partway through the run
+        sleep(0.5)
+        subscriber = connect(path)
+
+        received = []
+
+        def read() -> None:
+            while data := subscriber.recv(1 << 16):
+                received.append(data)
+
+        reader = Thread(target=read)
+        reader.start()
+
+        sleep(1.5)
+        assert p.poll() is None, "The target ended too soon"
+
+        stalled.setblocking(False)
+        closed = False
+        try:
+            while stalled.recv(1 << 16):
+                pass
+            closed = True
+        except BlockingIOError:
+            pass
+        assert closed, "The stalled subscriber is still connected"
+
+        p.wait(timeout=30)
+        reader.join(timeout=30)
+    finally:
+        p.kill()
+        p.wait()
+
+    assert p.returncode == 0, p.stderr.read().decode()
+
+    # What the subscriber got is a valid MOJO stream from the start
+    data = MojoFile(io.BytesIO(b"".join(received)))
+    data.unwind()
+
+    assert data.metadata["mode"] == "wall"
+    assert {s.thread for s in data.samples} >= {"MainThread", "SecondaryThread"}
@@ -0,0 +1,61 @@
+import json
+
+from tests.utils import retry_on_valueerror
+from tests.utils import run_target_output
+
+
+def read_trace(path):
+    """Return the slices of each named track, as (name, duration) pairs."""
+    events = json.loads(path.read_text())
+
+    names = {
+        (e["pid"], e["tid"]): e["args"]["name"]
+        for e in events
+        if e["ph"] == "M" and e["name"] == "thread_name"
+    }
+
+    open_slices = {}
+    tracks = {name: [] for name in names.values()}
+    for e in events:
+        track = (e["pid"], e["tid"])
+        if e["ph"] == "B":
+            open_slices.setdefault(track, []).append(e)
+        elif e["ph"] == "E":
+            begin = open_slices[track].pop()
+            tracks[names[track]].append((begin["name"], e["ts"] - begin["ts"]))
+
+    # Every slice is closed by the end of the trace
+    assert not any(open_slices.values()), open_slices
+
+    return tracks
+
+
+@retry_on_valueerror()
+def test_trace():
+    result, output = run_target_output("target", ".json", "--format", "trace")
+    assert result.returncode == 0, result.stderr.decode()
+
+    tracks = read_trace(output)
+
+    for thread in ("MainThread", "SecondaryThread"):
+        assert thread in tracks, tracks.keys()
+
+        # The frames that stay on the stack are merged into long slices
+        assert max(d for n, d in tracks[thread] if n == "bar") >= 2.5e6
+        assert max(d for n, d in tracks[thread] if n == "cpu_sleep") >= 0.8e6
+
+
+@retry_on_valueerror()
+def test_trace_tasks():
+    result, output = run_target_output(
+        "target_gather_tasks", ".json", "--format", "trace"
+    )
+    assert result.returncode == 0, result.stderr.decode()
+
+    tracks = read_trace(output)
+
+    # Each task gets its own track
+    for task in ("F4_0", "F4_1"):
+        track = f"{task} (MainThread)"
+        assert track in tracks, tracks.keys()
+        assert "f4" in {name for name, _ in tracks[track]}
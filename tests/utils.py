@@ -1,3 +1,4 @@
+import gzip
 import os
 import sys
 import typing as t
@@ -188,14 +189,20 @@ def run_echion(*args: str) -> CompletedProcess:
         raise
 
 
+def profile_path(test_name: str, suffix: str = ".mojo") -> Path:
+    output_file = PROFILES / f"{test_name}{suffix}"
+    n = count(1)
+    while output_file.exists():
+        output_file = PROFILES / f"{test_name}-{next(n)}{suffix}"
+
+    return output_file
+
+
 def run_target(
     target: str, *args: str
 ) -> t.Tuple[CompletedProcess, t.Optional[MojoFile]]:
     test_name = sys._getframe(1).f_code.co_name
-    output_file = (PROFILES / test_name).with_suffix(".mojo")
-    n = count(1)
-    while output_file.exists():
-        output_file = (PROFILES / f"{test_name}-{next(n)}").with_suffix(".mojo")
+    output_file = profile_path(test_name)
 
     result = run_echion(
         "-o",
@@ -214,6 +221,25 @@ def run_target(
     return result, m
 
 
+def run_target_output(
+    target: str, suffix: str, *args: str
+) -> t.Tuple[CompletedProcess, Path]:
+    """Run the target and return the path of the output, in any format."""
+    test_name = sys._getframe(1).f_code.co_name
+    output_file = profile_path(test_name, suffix)
+
+    result = run_echion(
+        "-o",
+        str(output_file),
+        *args,
+        sys.executable,
+        "-m",
+        f"tests.{target}",
+    )
+
+    return result, output_file
+
+
 def run_with_signal(target: Path, signal: int, delay: float, *args: str) -> Popen:
     p = Popen(
         [
@@ -272,3 +298,206 @@ def summary_to_json(summary: DataSummary) -> t.Dict[str, t.Any]:
 def dump_summary(summary: DataSummary, file: str) -> None:
     with open(file, "w") as f:
         json.dump(summary_to_json(summary), f, indent=2)
+
+
+def _varint(data: bytes, i: int) -> t.Tuple[int, int]:
+    n = shift = 0
+    while True:
+        b = data[i]
+        i += 1
+        n |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return n, i
+
+
+def _proto_fields(data: bytes) -> t.Iterator[t.Tuple[int, t.Union[int, bytes]]]:
+    i = 0
+    while i < len(data):
+        key, i = _varint(data, i)
+        field, wire = key >> 3, key & 7
+        if wire == 0:
+            value, i = _varint(data, i)
+            yield field, value
+        elif wire == 2:
+            size, i = _varint(data, i)
+            yield field, data[i : i + size]
+            i += size
+        else:
+            raise ValueError(f"Unexpected wire type {wire}")
+
+
+def _packed(value: t.Union[int, bytes]) -> t.List[int]:
+    if isinstance(value, int):
+        return [value]
+
+    values, i = [], 0
+    while i < len(value):
+        v, i = _varint(value, i)
+        values.append(v)
+    return values
+
+
+class PprofProfile:
+    """Just enough of a pprof decoder to check what echion writes."""
+
+    def __init__(self, data: bytes) -> None:
+        if data[:2] == b"\x1f\x8b":
+            data = gzip.decompress(data)
+
+        sample_types: t.List[t.Tuple[int, int]] = []
+        samples: t.List[t.Tuple[t.List[int], t.List[int], t.Dict[int, int]]] = []
+        locations: t.Dict[int, int] = {}
+        functions: t.Dict[int, int] = {}
+        self.strings: t.List[str] = []
+
+        for field, value in _proto_fields(data):
+            if field == 1:
+                vt = dict(_proto_fields(t.cast(bytes, value)))
+                sample_types.append((t.cast(int, vt[1]), t.cast(int, vt[2])))
+            elif field == 2:
+                location_ids: t.List[int] = []
+                values: t.List[int] = []
+                labels: t.Dict[int, int] = {}
+                for f, v in _proto_fields(t.cast(bytes, value)):
+                    if f == 1:
+                        location_ids.extend(_packed(v))
+                    elif f == 2:
+                        values.extend(_packed(v))
+                    elif f == 3:
+                        label = dict(_proto_fields(t.cast(bytes, v)))
+                        labels[t.cast(int, label[1])] = t.cast(int, label[2])
+                samples.append((location_ids, values, labels))
+            elif field == 4:
+                location = dict(_proto_fields(t.cast(bytes, value)))
+                line = dict(_proto_fields(t.cast(bytes, location[4])))
+                locations[t.cast(int, location[1])] = t.cast(int, line[1])
+            elif field == 5:
+                function = dict(_proto_fields(t.cast(bytes, value)))
+                functions[t.cast(int, function[1])] = t.cast(int, function[2])
+            elif field == 6:
+                self.strings.append(t.cast(bytes, value).decode())
+
+        self.sample_types = [(self.strings[a], self.strings[b]) for a, b in sample_types]
+
+        # Samples as (labels, stack from the root to the leaf, values)
+        self.samples = [
+            (
+                {self.strings[k]: self.strings[v] for k, v in labels.items()},
+                tuple(self.strings[functions[locations[i]]] for i in reversed(ids)),
+                values,
+            )
+            for ids, values, labels in samples
+        ]
+
+    def query(self, thread: str, frames: t.Tuple[str, ...]) -> t.List[int]:
+        """Sum the values of the samples of the thread with the given substack."""
+        totals = [0] * len(self.sample_types)
+        for labels, stack, values in self.samples:
+            if labels.get("thread name") != thread:
+                continue
+            for i in range(0, len(stack) - len(frames) + 1):
+                if stack[i : i + len(frames)] == frames:
+                    totals = [a + b for a, b in zip(totals, values)]
+                    break
+        return totals
+
+
+def _mojo_integer(data: bytes, i: int) -> t.Tuple[int, int]:
+    byte = data[i]
+    value, negative, shift = byte & 0x3F, byte & 0x40, 6
+    while byte & 0x80:
+        i += 1
+        byte = data[i]
+        value |= (byte & 0x7F) << shift
+        shift += 7
+    return -value if negative else value, i + 1
+
+
+def _mojo_string(data: bytes, i: int) -> t.Tuple[str, int]:
+    end = data.index(b"\0", i)
+    return data[i:end].decode(errors="replace"), end + 1
+
+
+class MojoProfile:
+    """Just enough of a MOJO decoder to check the sample counts of stacks."""
+
+    def __init__(self, data: bytes) -> None:
+        assert data[:3] == b"MOJ"
+        _, i = _mojo_integer(data, 3)
+
+        self.metadata: t.Dict[str, str] = {}
+        # All the metadata entries, in order, for the keys that are repeated
+        self.metadata_entries: t.List[t.Tuple[str, str]] = []
+        strings: t.Dict[int, str] = {}
+        frames: t.Dict[int, int] = {}
+        stacks: t.Dict[int, t.List[int]] = {}
+
+        # Samples as [thread, frame keys from the root to the leaf, values]
+        samples: t.List[t.List[t.Any]] = []
+
+        while i < len(data):
+            event, i = data[i], i + 1
+            if event == 1:  # METADATA
+                key, i = _mojo_string(data, i)
+                self.metadata[key], i = _mojo_string(data, i)
+                self.metadata_entries.append((key, self.metadata[key]))
+            elif event == 2:  # STACK
+                for _ in range(2):
+                    _, i = _mojo_integer(data, i)
+                thread, i = _mojo_string(data, i)
+                samples.append([thread, [], [1, 0]])
+            elif event == 3:  # FRAME
+                key, i = _mojo_integer(data, i)
+                _, i = _mojo_integer(data, i)
+                frames[key], i = _mojo_integer(data, i)
+                for _ in range(4):
+                    _, i = _mojo_integer(data, i)
+            elif event == 4:  # FRAME_INVALID
+                samples[-1][1].append(None)
+            elif event == 5:  # FRAME_REF
+                key, i = _mojo_integer(data, i)
+                samples[-1][1].append(key)
+            elif event == 6:  # FRAME_KERNEL
+                _, i = _mojo_string(data, i)
+            elif event in (9, 10):  # METRIC_TIME, METRIC_MEMORY
+                samples[-1][2][1], i = _mojo_integer(data, i)
+            elif event == 11:  # STRING
+                key, i = _mojo_integer(data, i)
+                strings[key], i = _mojo_string(data, i)
+            elif event == 13:  # STACK_DEF
+                key, i = _mojo_integer(data, i)
+                n, i = _mojo_integer(data, i)
+                stacks[key] = []
+                for _ in range(n):
+                    frame, i = _mojo_integer(data, i)
+                    stacks[key].append(frame)
+            elif event == 14:  # STACK_REF
+                key, i = _mojo_integer(data, i)
+                samples[-1][1].extend(stacks[key])
+            elif event == 15:  # SAMPLE_COUNT
+                samples[-1][2][0], i = _mojo_integer(data, i)
+            elif event not in (7, 8):  # GC, IDLE
+                raise ValueError(f"Unexpected MOJO event {event}")
+
+        def names(keys: t.List[int]) -> t.Tuple[str, ...]:
+            return tuple(strings.get(frames.get(k, -1), "?") for k in keys)
+
+        # Defined stacks, from the root to the leaf, by key
+        self.stacks = {key: names(keys) for key, keys in stacks.items()}
+
+        # Samples as (thread, stack from the root to the leaf, [count, metric])
+        self.samples = [(thread, names(keys), values) for thread, keys, values in samples]
+
+    def query(self, thread: str, frames: t.Tuple[str, ...]) -> t.List[int]:
+        """Sum the counts and the metrics of the samples of the thread with the
+        given substack."""
+        totals = [0, 0]
+        for sample_thread, stack, values in self.samples:
+            if sample_thread != thread:
+                continue
+            for i in range(0, len(stack) - len(frames) + 1):
+                if stack[i : i + len(frames)] == frames:
+                    totals = [a + b for a, b in zip(totals, values)]
+                    break
+        return totals